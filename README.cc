@@ -32,11 +32,18 @@ tau_plots->histfile = "outputhistograms.root";
 tau_plots->add(10,25.,125.,"p_{T,#tau}","taupt",&tau_pt_0,true,"GeV");
 tau_plots->add(10,25.,125.,"p_{T,b}","bpt",&pt_b,true,"GeV");
 tau_plots->add(10,25.,125.,"p_{T,light-jet}","ljetpt",&pt_ljet,true,"GeV");
+//Float_t/Double_t/Int_t/... are bound at compile time, derived quantities can be bound as an expression evaluated at fill time
+tau_plots->add(new variable("ptratio","p_{T,#tau}/p_{T,b}",10,0,5), [&](){ return tau_pt_0/pt_b; });
 
 tau_plots->add_region("the regions you have 1");
 tau_plots->add_region("the regions you have 2");
 tau_plots->add_region("the regions you have 3");
 tau_plots->add_region("the regions you have 4");
+//optional: variables used per region (name pattern, or an explicit list of regions), other regions keep all variables
+tau_plots->set_region_variables("CR", {"taupt"});
+tau_plots->set_region_variables({"the regions you have 1","the regions you have 2"}, {"taupt","bpt"});
+//yields (printyield, calculateYield, templatesample, FakeFactorMethod) use tau_plots->yieldvariable where it is active,
+//otherwise the first active variable of the region
 
 //seq: sample name, sample fill name (in case memory leak), sample title name, sample color in the stack.
 tau_plots->init_sample("data","data","data",kBlack);
@@ -61,6 +68,81 @@ for (Long64_t jentry=0; jentry<nentries;jentry++) {
 	if(sampleisGluon && region1cut) tau_plots->fill_hist("ttbar_g","the regions you have 1");
 		//...
 }
+//faster: resolve sample/region/variation once before the event loop, then fill through the handle
+FillHandle h_g_reg1 = tau_plots->book("ttbar_g","the regions you have 1","NOMINAL");
+for (Long64_t jentry=0; jentry<nentries;jentry++) {
+	fChain->GetEntry(jentry);
+	if(sampleisGluon && region1cut) tau_plots->fill_hist(h_g_reg1);
+}
+//./bin/benchmark_run [nevents] compares the fill rate of both methods
+//all cores without a batch system: one forked process per input file, retried on failure, results merged pairwise
+histDriver driver([&](TString outputname){ /*new histSaver(outputname), add(), add_region(), add_sample() as above*/ return saver; },
+	[&](histSaver *saver, TString inputfile){ /*open inputfile, loop and fill saver*/ });
+driver.nworkers = 16;
+histSaver *merged = driver.run(inputfiles, "outputhistograms");
+merged->write();
+//when workers x histograms do not fit in memory: one copy of the bins in shared memory, filled with atomic adds.
+//setup() sets usearena = 1 and books every slot (book(), book_fanout(), ...) before the workers start
+driver.sharedmemory = 1;
+//the workers should fill through the FillHandles of these slots, a worker meeting an entry that was not booked
+//stops with exit(1) and its input ends up in driver.failed
+//the same without the driver: saver->share_bins(); fork() the workers; wait for them; saver->sync_slots();
+//or as an executable with a library exporting extern "C" histdriver_setup/histdriver_fill:
+//./bin/histdriver_run libmyfill.so outputhistograms -j 16 -r 2 @filelist.txt (-s: shared memory)
+//incremental filling: inputs whose content and configuration (variables, binning, bound types, regions, samples, weight variations,
+//your string) did not change since the last run are not read again, their histograms are added from tau_plots->partialdir
+//("partials" by default). Put the version of bound expressions in your string, their code is not part of the fingerprint.
+for(auto inputname : inputfiles){
+	if(!tau_plots->begin_input(inputname, "cuts v3")) continue;
+	//open inputname, loop over the events and fill as above
+	tau_plots->end_input();
+}
+
+//multithreaded filling: book all slots first, each chunk of entries is filled into its own FillShard,
+//shards are merged in chunk order so the histograms are bit-identical for any number of threads
+FillHandle h_g = tau_plots->book("ttbar_g","the regions you have 1");
+tau_plots->fill_parallel(nentries, 16, [&](FillShard *shard, int ithread, Long64_t first, Long64_t last){
+	//use a reader/TTree owned by thread ithread
+	double values[nvariable];
+	for (Long64_t jentry=first; jentry<last;jentry++) {
+		readers[ithread]->GetEntry(jentry);
+		//values[ivar] = ...; //variable::scale is applied to double/float values, not to int values
+		//mixed float and integer branches: apply the scale yourself and call shard->fill_scaled(h_g, values, weight)
+		if(sampleisGluon && region1cut) shard->fill(h_g, values, weight);
+	}
+});
+//large configurations: fill_atomic() takes the same callback, the threads add to one set of bins with atomic adds
+//instead of one copy per shard (not bit-identical between runs), see ./bin/benchmark_run for the speed of both
+//tau_plots->fill_atomic(nentries, 16, [&](FillShard *shard, int ithread, Long64_t first, Long64_t last){...});
+//overlapping regions: fill every region the event belongs to in one call (region id = position in tau_plots->regions)
+RegionHandle h_g_nominal = tau_plots->book_regions("ttbar_g","NOMINAL");
+tau_plots->fill_hist(h_g_nominal, belongregion);            //BelongRegion of the event
+tau_plots->fill_hist(h_g_nominal, (1ULL<<id1)|(1ULL<<id2)); //or a bitmask, id = tau_plots->findregion("region name")
+//weight-only systematics: register the weights like set_weight, the bins are found once and filled for every variation
+tau_plots->add_weight_variation("SF_up",&weight_sf_up);
+tau_plots->add_weight_variation("SF_down",&weight_sf_down);
+FanoutHandle h_g_allweights = tau_plots->book_fanout("ttbar_g","the regions you have 1"); // NOMINAL + registered variations
+tau_plots->fill_hist(h_g_allweights);
+//or give the weights explicitly, weights[0] for the nominal: book_fanout(sample, region, "NOMINAL", {"PDF1","PDF2",...}); fill_hist(handle, weights);
+//columnar filling (bulk-read branches, RDataFrame Take, numpy arrays): one column per variable in the order of add()
+std::vector<const float*> columns = {taupt_array, bpt_array, ljetpt_array};
+tau_plots->fill_batch(h_g, columns, weight_array, nevents_in_block);
+//with your own threads (or TTreeProcessorMT): FillShard shard(tau_plots); ... then tau_plots->merge_shard(&shard) in a fixed order
+//tau_plots->usearena = 1; (before booking/filling) keeps the bins of all histograms in a few large pages,
+//the TH1D are only created when grabhist/write/plot_stack needs them
+//in all fill methods a histogram (or arena block) is only created on its first fill, also with weight 0 so that the entries count every fill as TH1D::Fill does:
+//grabhist (and everything using it: write_trexinput, templatesample, FakeFactorMethod...) gets an empty histogram for
+//booked but unfilled ones, write() skips the ones that were neither filled nor grabbed
+//RDataFrame: one action per sample/variation, all of them filled in the same (implicit MT) event loop
+#include "histSaverAction.h"
+ROOT::EnableImplicitMT();
+ROOT::RDataFrame df("tree", files);
+auto dfg = df.Define("regionmask", "ULong64_t((region1cut<<id1)|(region2cut<<id2))").Define("w", "double(weight)");
+auto r_nominal = dfg.Book<ULong64_t, double, float, float, float>(histSaverAction(tau_plots,df.GetNSlots(),"ttbar_g"), {"regionmask","w","tau_pt_0","pt_b","pt_ljet"});
+auto r_sfup = dfg.Define("w_sfup", "double(weight_sf_up)").Book<ULong64_t, double, float, float, float>(histSaverAction(tau_plots,df.GetNSlots(),"ttbar_g","SF_up"), {"regionmask","w_sfup","tau_pt_0","pt_b","pt_ljet"});
+r_nominal.GetValue(); //runs the event loop once for every booked action
+tau_plots->write();
+
 tau_plots->stackorder.push_back("ttbar_g")
 tau_plots->stackorder.push_back("ttbar_j")
 tau_plots->stackorder.push_back("ttbar_b")
@@ -71,6 +153,14 @@ tau_plots->overlay("signal2")
 tau_plots->overlay("signal3")
 
 tau_plots->write(TFile* outputfile) // write the histograms into rootfile for further use
+tau_plots->set_compression(ROOT::RCompressionSetting::EAlgorithm::kLZ4, 4); //optional, kZSTD for archival
+tau_plots->write(8); //the variation files written by 8 threads
+//variation by variation: a finished variation is written and freed on a background thread while the next one is filled,
+//write() waits for it and writes the rest
+for(auto variation : variations){
+	//loop over the events filling variation
+	tau_plots->complete_variation(variation); //or complete_sample("ttbar_g") when a sample is done in all variations
+}
 tau_plots->plot_stack();
 
 //=============Read from a histogram============
@@ -87,6 +177,7 @@ tau_plots->add_region("the regions you have 2");
 tau_plots->add_region("the regions you have 3");
 tau_plots->add_region("the regions you have 4");
 //seq: sample name, sample fill name (in case memory leak), sample title name, sample color in the stack.
+//tau_plots->lazyread = 1; //before read_sample: only the names are registered, each histogram is read when grabbed
 tau_plots->read_sample("data","data","data",kBlack);
 tau_plots->read_sample("other","other","Other samples",kYellow);
 tau_plots->read_sample("ttbar_g","ttbar_g","t#bar{t}(gluon fake #tau)",(enum EColor)7);
@@ -96,6 +187,14 @@ tau_plots->read_sample("ttbar_lep","ttbar_lep","t#bar{t}(lepton fake #tau)",kGre
 tau_plots->read_sample("ttbar_real","ttbar_real","t#bar{t}(real #tau)",kRed);
 tau_plots->read_sample("ttbar_c","ttbar_c","t#bar{t}(c-jets fake #tau)",kOrange);
 tau_plots->read_sample("ttbar_nomatch","ttbar_nomatch","t#bar{t}(no truth matched fake #tau)",kGray);
+//or all at once: each input file is indexed once and read by its own thread, then added in the order given
+std::vector<sampleRead> reads;
+reads.emplace_back("ttbar_g","ttbar_g","NOMINAL","t#bar{t}(gluon fake #tau)",(enum EColor)7,1,file_ttbar);
+reads.emplace_back("other","other","NOMINAL","Other samples",kYellow,1,file_other);
+tau_plots->read_samples(reads);
+//input files you close before the histSaver is deleted: tau_plots->forgetfile(file); frees its key index
+//tau_plots->usecache = 1; (before reading) keeps a binary copy <input>.root.hcache next to each input, read through mmap as long as the input keeps the size and modification time (ns) it was written from
+tau_plots->dump_cache("plots.hcache"); //the whole plot_lib and samples, reloaded instantly by tau_plots->load_cache("plots.hcache") after add()/add_region()
 
 tau_plots->stackorder.push_back("ttbar_g")
 tau_plots->stackorder.push_back("ttbar_j")
@@ -113,12 +212,14 @@ void muteregion(TString keyword);
 void unmuteregion(TString keyword);			//decide if the region contains the keyword is plotted
 void overlay(TString _overlaysample);		//the sample _overlaysample is shown as overlay in the plots instead of stack
 TH1D* grabhist(TString sample, TString region, int ivar);	//get specific histogram
+TH1D* grabhist(int isample, int iregion, int ivariation, int ivar);	//the same by ids: sampleid(name), findregion(name), variationid(name), varid(name); for loops over many regions/variations
 void merge_regions(TString inputregion1, TString inputregion2, TString outputregion); //merge 2 regions into another region and keeps the inputs
 
 double templatesample(TString fromregion,string formula,TString toregion,TString newsamplename,TString newsampletitle,enum EColor color,bool scaletogap, double SF = 1); //used for fake estimation methods.
 //example: tau_plots->templatesample("ss_region","1 data -1 smhiggs -1 wjet -1 diboson -1 zll -1 ztautau -1 top -1 fake","os_region","fakeSS","Fake",kYellow,0,1.31597);
 
 void write_trexinput(TString NPname = "NOMINAL", TString writeoption = "recreate"); //in case you are using TRexFitter (https://gitlab.cern.ch/TRExStats/TRExFitter) This function will generate the histogram inputs.
+void write_trexinput(std::vector<TString> NPnames, std::vector<TString> writenames = {}, TString writeoption = "update", bool consolidated = 0); //all NPs at once, every file is opened once; consolidated = 1 writes a single trexinputs.root with variable/region/sample directories
 
 
 //=====================================Usage2: HISTFITTER=====================================
@@ -141,9 +242,20 @@ fitter->addfithist("g",hist1,binlow,binhigh);
 fitter->addfithist("g",hist2,binlow,binhigh);
 fitter->addfithist("j",hist1,binlow,binhigh);
 fitter->addfithist("j",hist2,binlow,binhigh);
+//fitter->analyticgradient = 1; //Minuit with the analytic derivative of the chi2
+//fitter->linearsolve = 1; //normal equations, then Newton steps on the exact chi2, instead of Minuit (fallback to Minuit for out of range results)
+//fitter->comparelinear = 1; //also runs Minuit after each linear solution and prints both, the values should agree well within the errors
+//histSaver: tau_plots->linearfit = 1; before fit_scale_factor()
+//histSaver: all variations at once, every slice x variation fit runs on its own thread (HISTFITTER has no global state):
+//auto sfs = tau_plots->fit_scale_factors(&fitregions, &variable, &scalesamples, &slices, {"NOMINAL","NP1_up","NP1_down"}, 16); //sfs[variation][param][islice]
 double chi2 = fitter->fit(val,err,0);
 printf("%s, ptbin: %d, b: %f+/-%f, c: %f+/-%f, g: %f+/-%f, j: %f+/-%f;  Chi2:%f\n",nprong[iprong].Data(), ptbin+1, val[0],err[0], val[1],err[1], val[2],err[2], val[3],err[3], chi2);
 fitter->calculateEigen();
+//toys: every bin is drawn from a Poisson around the sum of the components, toy i only depends on (toyseed, i)
+//without toyseed every process takes its own seed from host, pid and time and prints it; batch jobs splitting
+//the toys should set a different toyseed per job (e.g. the job number + 1), rerunning with the printed seed repeats them
+//fitter->toyseed = 12345;
+//fitter->asimovfit(10000, "toys.root", 16); //TTree asimovFitResults, one entry per toy in toy order, same for any number of threads
 fitter->clear();
 
 //=====================================Usage3: EigenVector=====================================
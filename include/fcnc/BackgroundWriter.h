@@ -0,0 +1,29 @@
+#ifndef BACKGROUNDWRITER
+#define BACKGROUNDWRITER
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+//One I/O thread running queued jobs in order, used by histSaver::complete_variation()/complete_sample()
+//to write and free finished histograms while the filling continues.
+class BackgroundWriter
+{
+public:
+  BackgroundWriter();
+  ~BackgroundWriter(); //runs the queued jobs, then stops the thread
+  void push(std::function<void()> job);
+  void wait(); //returns when every queued job is done
+  int pending();
+private:
+  std::deque<std::function<void()>> jobs;
+  std::mutex lock;
+  std::condition_variable changed;
+  bool running; //a job is being run
+  bool stop;
+  std::thread worker;
+  void loop();
+};
+#endif
@@ -0,0 +1,42 @@
+#ifndef FILLSHARD
+#define FILLSHARD
+
+#include <vector>
+#include "HistArena.h"
+
+class histSaver;
+struct FillHandle;
+
+//Private accumulator of one worker thread. It uses the slots booked on the histSaver
+//(book() has to be called before the threads start) and is added back by histSaver::merge_shard().
+//direct: no private bins, the bins of the histSaver slots are updated with atomic adds (histSaver::fill_atomic()),
+//only the entry counts are kept here.
+class FillShard
+{
+public:
+  FillShard(histSaver *_saver, bool _direct = 0);
+  ~FillShard();
+  histSaver *saver;
+  bool direct;
+  HistArena arena;
+  std::vector<std::vector<double*>> sumw; //sumw[islot][ivar], empty until the slot is filled
+  std::vector<std::vector<double*>> sumw2;
+  std::vector<double> entries;
+  std::vector<double> local; //column buffer of direct batch fills
+  //values[ivar] as read from the branches, variable::scale (floating point values only) and the histSaver::getVal clamping are applied here
+  void fill(FillHandle handle, const double *values, double weight);
+  void fill(FillHandle handle, const float *values, double weight);
+  void fill(FillHandle handle, const int *values, double weight);
+  void fill_scaled(FillHandle handle, const double *values, double weight); //variable::scale already applied, for columns of mixed types
+  void fill_batch(FillHandle handle, const std::vector<const float*> &values, const double *weights, long nevents);
+  void fill_batch(FillHandle handle, const std::vector<const double*> &values, const double *weights, long nevents);
+  void fill_batch(FillHandle handle, const std::vector<const int*> &values, const double *weights, long nevents);
+  void clear();
+private:
+  void allocate(int islot);
+  template<typename T>
+  void fillvalues(FillHandle handle, const T *values, double weight, bool scale = 1);
+  template<typename T>
+  void fill_columns(FillHandle handle, const std::vector<const T*> &values, const double *weights, long nevents);
+};
+#endif
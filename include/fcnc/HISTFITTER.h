@@ -1,6 +1,39 @@
 #include "fcnc_include.h"
 #include "EigenVectorCalc.h"
 
+//fit model compiled from HISTFITTER::fithists before the minimisation, evaluated by HISTFITTER::fcn without allocations.
+//chi2 = sum_b (data_b - total_b)^2 / var_b over the bins with total_b != 0,
+//total_b = sum_c s_c sumw_cb, var_b = sum_c s_c^2 err2_cb, s_c = par[ipar_c] or 1 for components without a parameter.
+struct fitModel
+{
+	int nbin;	//bins where any component is non-zero, the others never contribute
+	int ncomp;	//components with a fit parameter
+	std::vector<int> ipar;
+	std::vector<double> sumw;	//sumw[c*nbin + b]
+	std::vector<double> err2;
+	std::vector<double> fixedsumw;	//sum of the components without a parameter
+	std::vector<double> fixederr2;
+	std::vector<double> data;
+	std::vector<double> total;	//work arrays
+	std::vector<double> var;
+	void compile(std::map<TString, TH1D*> &fithists);
+	double chi2(const double *par, double *grad = 0);	//grad[ipar] += dchi2/dpar
+	double hessian(const double *par, int npar, double *grad, double *hess);	//exact grad[k] and hess[k*npar + l] of chi2, overwritten
+	void poissondata(unsigned long long seed, unsigned long long itoy);	//data_b = Poisson(sum of the components at scale 1) of toy itoy
+};
+
+//counter based random numbers for the toys: number n of toy itoy is a hash of (seed, itoy, n),
+//a toy is the same whichever thread generates it and whatever toys were generated before
+struct toyRandom
+{
+	toyRandom(unsigned long long seed, unsigned long long itoy);
+	unsigned long long key;
+	unsigned long long counter;
+	static unsigned long long mix(unsigned long long x);	//splitmix64 finaliser
+	double uniform();	//(0,1)
+	long poisson(double mean);
+};
+
 class HISTFITTER
 {
 public:
@@ -15,6 +48,26 @@ public:
 	std::map<TString, TH1D*> fithists;
 	std::map<TString, int> iregion;
 	std::map<TString, TH1D*>::iterator iter;
+	fitModel model;
+	std::vector<double> covariance;	//covariance[i*nparam + j] of the last fit
+	bool analyticgradient;	//pass dchi2/dpar to Minuit instead of numerical derivatives
+	//fit() minimises the chi2 without Minuit: the normal equations of the linear model with the variance taken from
+	//the previous solution (up to nlinearstep iterations) give the start of up to nlinearstep Newton steps on the exact chi2,
+	//whose variance depends on the parameters. The errors come from the Hessian of the exact chi2, as with Minuit.
+	//Minuit is used when a matrix is not positive definite or a parameter ends outside [lowrange, highrange].
+	bool linearsolve;
+	bool comparelinear;	//also run Minuit after every linear solution and print the differences
+	int nlinearstep;
+	int nlinear;	//fits done by the linear solver / by Minuit
+	int nminuit;
+	bool solvelinear(fitModel &fitmodel, double *bstvl, double *error, double &chi2, std::vector<double> &cov);
+	//minimises fitmodel without touching the members, cov is filled like covariance. Used by fit() and the toys of asimovfit()
+	double minimize(fitModel &fitmodel, double *bstvl, double *error, std::vector<double> &cov, bool &linear);
+	//the toys of fit(..,1) and asimovfit() are reproducible for a given toyseed. 0: a seed unique to the process
+	//(host, pid, time) is taken at the first toy and printed, set it explicitly to reproduce toys or split them across jobs
+	unsigned long long toyseed;
+	void settoyseed();
+	unsigned long long ntoy;	//toys generated so far, the next toy is number ntoy
 	float *eigenval;
 	float **eigenvector;
 	TH1D *h_metadata;
@@ -23,10 +76,11 @@ public:
 	std::vector<double > stepsize;
 	std::vector<double > lowrange;
 	std::vector<double > highrange;
-	void asimovfit(int fitnumber, TString outfile);
+	//fitnumber toys with independent copies of the compiled model on nthreads threads (<= 0: all cores),
+	//results are written in toy order, so asimovFitResults does not depend on nthreads
+	void asimovfit(int fitnumber, TString outfile, int nthreads = 0);
 	void addfithist(TString component, TH1D* inputhist, int begin, int end, TString fitparam = "");
 	static int parsecomponentname(TString name);
-	static void fcn(Int_t &npar, Double_t *gin, Double_t &f, Double_t *par, Int_t iflag);
 	static void savemetadata(TH1D *metadatahist, TString what, double value);
 	static double readmetadata(TH1D *metadatahist, TString what);
 	double fit(double *bstvl, double *error, bool asimov);
@@ -0,0 +1,32 @@
+#ifndef HISTARENA
+#define HISTARENA
+
+#include <vector>
+
+//Bin storage for histSaver::usearena: sumw and sumw2 of all histograms packed into a few large pages.
+//allocate() never moves memory that was handed out, so callers may keep the pointers.
+//shared: the pages are anonymous MAP_SHARED mappings, pages allocated before fork() are seen by all the children.
+class HistArena
+{
+public:
+  HistArena(long _pagesize = 1<<20, bool _shared = 0);
+  ~HistArena();
+  long pagesize; //in doubles
+  bool shared;
+  long used;     //doubles used in the last page
+  long nalloc;   //number of allocate() calls
+  long total;    //doubles handed out
+  std::vector<double*> pages;
+  std::vector<long> pagesizes;
+  double* allocate(long n);
+  void clear();
+};
+
+//lock free add for bins updated by several processes or threads
+inline void atomic_add(double *target, double value){
+  double expected, desired;
+  __atomic_load(target, &expected, __ATOMIC_RELAXED);
+  do desired = expected + value;
+  while(!__atomic_compare_exchange(target, &expected, &desired, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+#endif
@@ -0,0 +1,92 @@
+#ifndef HISTCACHE
+#define HISTCACHE
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include "TString.h"
+
+class TH1;
+class TH1D;
+
+//Binary histogram cache read through mmap: histograms are looked up by name and their bins are
+//used directly from the mapped file, so several processes can share one cache read-only.
+//Layout: cacheHeader | cacheSample[nsample] | cacheEntry[nhist] | bins (double) | strings (char, 0 terminated)
+//All offsets are in bytes from the start of the file. The cache is only valid on the architecture that wrote it.
+struct cacheHeader
+{
+  char magic[8];
+  int version;
+  int nsample;
+  long nhist;
+  long size;
+  long sourcestamp[3]; //size, modification time (s, ns) of the file the cache was written from, 0 if none
+};
+
+struct cacheSample
+{
+  long name;
+  long title;
+  int color;
+  int unused;
+};
+
+struct cacheEntry
+{
+  long name;      //key of the lookup: the histogram name in the source file, or the plot_lib name
+  long sample;    //plot_lib position, empty strings for source file caches
+  long region;
+  long variation;
+  long varname;
+  long title;
+  long sumw;      //nbins+2 doubles, followed by nbins+2 doubles of sumw2
+  long xbins;     //nbins+1 bin edges for variable binning, 0 otherwise
+  int nbins;
+  int fillcolor;
+  int linecolor;
+  int unused;
+  double xlow;
+  double xhigh;
+  double entries;
+};
+
+class HistCache
+{
+public:
+  HistCache();
+  ~HistCache();
+  TString filename;
+  char *data;
+  long size;
+  const cacheHeader *header;
+  const cacheSample *samples;
+  const cacheEntry *entries;
+  std::unordered_map<std::string, long> index; //name -> entry
+  bool open(TString _filename); //false if the file is missing or not a cache
+  void close();
+  const char* text(long offset) const { return data + offset; }
+  const double* sumw(const cacheEntry &entry) const { return (const double*)(data + entry.sumw); }
+  const double* sumw2(const cacheEntry &entry) const { return sumw(entry) + entry.nbins + 2; }
+  const cacheEntry* find(TString name) const;
+  TH1D* hist(const cacheEntry &entry) const; //new histogram owned by the caller, not attached to any directory
+  static bool stamp(TString sourcefile, long *sourcestamp); //size and modification time of sourcefile, false if it does not exist
+  static bool uptodate(TString cachefile, TString sourcefile); //cachefile was written from sourcefile as it is now
+  static unsigned long long hash(const char *bytes, long n, unsigned long long seed = 14695981039346656037ULL); //FNV-1a
+  static unsigned long long filehash(TString filename); //hash of the file content, 0 if it cannot be read
+
+  //writing
+  long sourcestamp[3]; //stored in the header, set with stamp() before reading the source
+  struct pendingEntry
+  {
+    std::string name, sample, region, variation, varname, title;
+    cacheEntry entry;
+    std::vector<double> bins;
+    std::vector<double> xbins;
+  };
+  std::vector<std::pair<std::string, std::pair<std::string, int>>> pendingsamples;
+  std::vector<pendingEntry> pending;
+  void add_sample(TString name, TString title, int color);
+  void add(TString name, TH1 *hist, TString sample = "", TString region = "", TString variation = "", TString varname = "");
+  bool write(TString _filename); //writes the pending samples and histograms, then clears them
+};
+#endif
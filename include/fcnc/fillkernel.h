@@ -0,0 +1,60 @@
+#ifndef FILLKERNEL
+#define FILLKERNEL
+
+#include "histSaver.h"
+
+//Batch bin-index kernel used by histSaver::fill_batch and FillShard::fill_batch.
+//Applies variable::scale (floating point columns only, as readBinding) and the histSaver::clampVal clamping, then finds the bin of the
+//uniform booked axis with a precomputed nbins/(xhigh-xlow) instead of a division per value.
+//Values within rounding of a bin edge can land in the neighbouring bin compared to TAxis::FindBin.
+struct binRange
+{
+  float scale;
+  float lo;      //clamping range, from xbins if given
+  float hi;
+  float hiclamp; //value used for entries >= hi
+  double xlow;   //booked axis
+  double xhigh;
+  double invwidth;
+  int nbins;
+  binRange(variable *var){
+    scale = var->scale;
+    lo = var->xbins ? var->xbins->at(0) : var->xlow;
+    hi = var->xbins ? var->xbins->at(var->xbins->size()-1) : var->xhigh;
+    hiclamp = hi*0.999999;
+    xlow = var->xlow;
+    xhigh = var->xhigh;
+    nbins = var->nbins;
+    invwidth = nbins/(xhigh-xlow);
+  }
+};
+
+const int fillblock = 256;
+
+//bins[k] for values[0..n), n <= fillblock; branch free so the compiler can vectorize it
+template<typename T>
+inline void findbins(const binRange &r, const T *values, int n, int *bins){
+  for (int k = 0; k < n; ++k){
+    float x = scaledValue(values[k], r.scale);
+    x = x >= r.hi ? r.hiclamp : x;
+    x = x < r.lo ? r.lo : x;
+    double t = (x - r.xlow)*r.invwidth;
+    int b = 1 + int(t >= 0 ? (t < r.nbins ? t : r.nbins - 1) : -1);
+    bins[k] = x < r.xhigh ? b : r.nbins + 1; //also catches nan
+  }
+}
+
+template<typename T>
+inline void fill_column(const binRange &r, const T *values, const double *weights, long n, double *sumw, double *sumw2){
+  int bins[fillblock];
+  for (long start = 0; start < n; start += fillblock){
+    int nblock = n - start < fillblock ? n - start : fillblock;
+    findbins(r, values + start, nblock, bins);
+    const double *w = weights + start;
+    for (int k = 0; k < nblock; ++k){
+      sumw[bins[k]] += w[k];
+      sumw2[bins[k]] += w[k]*w[k];
+    }
+  }
+}
+#endif
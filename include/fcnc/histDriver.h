@@ -0,0 +1,40 @@
+#ifndef HISTDRIVER
+#define HISTDRIVER
+
+#include <vector>
+#include <functional>
+#include "TString.h"
+
+class histSaver;
+
+//Fills one histSaver from a list of input files with forked worker processes:
+//each input is filled by its own process into a private histSaver and dumped as a HistCache,
+//a failed input is started again up to nretry times, then the partial caches are merged pairwise
+//(also in worker processes) until one is left, which is loaded into the returned histSaver.
+//setup(outputname) has to create the histSaver with the same add()/add_region()/add_sample() every time,
+//the workers use a scratch outputname in workdir, the returned histSaver uses outputfilename.
+//sharedmemory: setup(outputfilename) is called once, its booked slots are moved to shared memory (histSaver::share_bins())
+//and every worker fills them directly, no partial caches and no merging. setup() has to set usearena and book every slot.
+//A failed input may have filled part of its events, it is not retried.
+//A worker that calls exit() (histSaver errors) is a failed job, it leaves without the atexit cleanup of ROOT.
+//A failed merge drops the inputs of both partials and adds them to failed, run() always returns the histSaver.
+class histDriver
+{
+public:
+  histDriver(std::function<histSaver*(TString)> _setup, std::function<void(histSaver*, TString)> _fill);
+  std::function<histSaver*(TString)> setup;
+  std::function<void(histSaver*, TString)> fill;
+  int nworkers;  //<= 0: all cores
+  int nretry;
+  bool sharedmemory;
+  TString workdir;
+  std::vector<TString> failed; //inputs still failing after nretry retries or lost in a failed merge
+  histSaver* run(std::vector<TString> inputs, TString outputfilename);
+  //runs job(ijob) for all njob in child processes, returns the jobs that succeeded,
+  //produced(ijob) is checked by the parent before a job counts as done
+  std::vector<bool> forkjobs(int njob, std::function<bool(int)> job, TString what, std::function<bool(int)> produced = nullptr);
+private:
+  TString jobdir(TString stage, int ijob);
+  void removedir(TString dir);
+};
+#endif
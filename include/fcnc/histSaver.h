@@ -2,9 +2,22 @@
 #define histSaver_h
 #include <iostream>
 #include <map>
+#include <functional>
+#include <unordered_map>
+#include <unordered_set>
+#include <type_traits>
+#include <typeinfo>
 #include "TH1D.h"
 #include "TFile.h"
 #include "observable.h"
+#include "Compression.h"
+#include "HistArena.h"
+#include "FillShard.h"
+
+class BelongRegion;
+class TKey;
+class HistCache;
+class BackgroundWriter;
 
 struct variable{
 
@@ -21,8 +34,43 @@ struct variable{
   variable(TString _name, TString _title, int _nbins, float _xlow, float _xhigh, TString _unit = "", float _scale = 1, int _rebin = 1,   std::vector<double>* _xbins = 0)
   :name(_name), title(_title), nbins(_nbins), xlow(_xlow), xhigh(_xhigh), unit(_unit), scale(_scale), rebin(_rebin), xbins(_xbins){}
 
+  //same as TAxis::FindBin of the booked (uniform) histogram
+  int findbin(double val){
+    if(val < xlow) return 0;
+    if(!(val < xhigh)) return nbins+1;
+    return 1 + int(nbins*(val-xlow)/(xhigh-xlow));
+  }
+
+};
+
+struct varBinding;
+Float_t readUnbound(const varBinding &binding); //reader of a variable added without value, reports it and exits
+
+//value source of one variable, the reader is chosen at compile time from the bound type
+struct varBinding
+{
+  Float_t (*read)(const varBinding &binding);
+  const void *address;
+  const char *type; //typeid name of the bound type, "expression" for expressions
+  variable *var;
+  std::function<double()> expression;
+  varBinding(variable *_var = 0): read(&readUnbound), address(0), type(""), var(_var) {};
 };
 
+//floating point values are scaled by variable::scale, integers are taken as they are
+template<typename T>
+inline Float_t scaledValue(T value, float scale){
+  if(std::is_floating_point<T>::value) return value*scale;
+  return value;
+}
+
+template<typename T>
+Float_t readBinding(const varBinding &binding){
+  return scaledValue(*(const T*)binding.address, binding.var->scale);
+}
+
+Float_t readExpression(const varBinding &binding);
+
 struct fcncSample
 {
 public:
@@ -33,6 +81,104 @@ public:
   enum EColor color;
 };
 
+struct FillHandle
+{
+  int islot;
+  FillHandle(int _islot = -1): islot(_islot) {};
+  bool valid() const {return islot >= 0;}
+};
+
+struct fillSlot
+{
+  TString sample;
+  TString region;
+  TString variation;
+  std::vector<TH1D*>* hists; //points to plot_lib[sample][region][variation]
+  std::vector<double*> sumw;  //arena storage per variable (usearena)
+  std::vector<double*> sumw2;
+  double entries; //fills written to the bin arrays directly, not yet in the histogram statistics
+  double *sharedentries; //the same for fills of forked workers, in the shared arena (sharedbins)
+  std::vector<double> synced; //part of entries already in the histogram of a variable synced alone
+  std::vector<int> ivars; //variables active in the region, see histSaver::activevars()
+  bool completed; //written out by complete_sample()/complete_variation(), filling it is an error
+};
+
+struct regionVariables
+{
+  TString region;
+  bool exact; //match the region name exactly instead of region.Contains()
+  std::vector<int> ivars;
+};
+
+//arguments of one read_sample() call, for histSaver::read_samples()
+struct sampleRead
+{
+  TString samplename;
+  TString savehistname;
+  TString variation;
+  TString sampleTitle;
+  enum EColor color;
+  double norm;
+  TFile *inputfile;
+  bool applyVariation;
+  std::vector<std::vector<TH1D*>> hists; //hists[iregion][ivar] as read from the file
+  sampleRead(TString _samplename, TString _savehistname, TString _variation, TString _sampleTitle, enum EColor _color, double _norm, TFile *_inputfile=0, bool _applyVariation=1);
+};
+
+//names interned to dense ids, ids stay valid for the lifetime of the histSaver
+struct nameIndex
+{
+  std::unordered_map<std::string, int> ids;
+  std::vector<TString> names; //names[id]
+  int find(TString name) const {
+    auto found = ids.find(name.Data());
+    return found == ids.end() ? -1 : found->second;
+  }
+  int intern(TString name){
+    auto inserted = ids.insert(std::make_pair(std::string(name.Data()), (int)names.size()));
+    if(inserted.second) names.push_back(name);
+    return inserted.first->second;
+  }
+};
+
+//keys of one input file, see histSaver::indexkeys(). No TKey is kept: a file closed and another one opened at the
+//same address finds a different stamp (name, UUID, end of file) and is indexed again
+struct fileIndex
+{
+  TString name;
+  TString uuid;
+  Long64_t end;
+  std::unordered_map<std::string, Short_t> cycles; //key name -> highest cycle
+  HistCache *cache; //usecache: the histograms are read from <input>.hcache instead
+  fileIndex(): end(0), cache(0) {};
+};
+
+//one read_sample() call registered by histSaver::lazyread, read per variable by grabhist()
+struct lazySource
+{
+  TFile *file;
+  TString histname; //without the variable name
+  TString sampleTitle;
+  enum EColor color;
+  double norm;
+  std::vector<bool> loaded; //loaded[ivar]
+};
+
+//one booked slot per variation of the same (sample, region), filled from one value computation
+struct FanoutHandle
+{
+  std::vector<int> islots;   //islots[0] is the nominal slot, then one per variation
+  std::vector<int> iweights; //index in histSaver::weightvariations, -1 if not registered
+};
+
+//slots of one (sample, variation) for every region, indexed by the region id (position in histSaver::regions)
+struct RegionHandle
+{
+  TString sample;
+  TString variation;
+  std::vector<int> islots; //-1 until the region is first filled
+};
+
 class histSaver{
 public:
   TString inputfilename;
@@ -52,6 +198,8 @@ public:
   std::vector<TString> overlaytogether;
   TFile* inputfile;
   std::map<TString,TFile*> outputfile;
+  std::map<TString,bool> freshoutput; //outputfile[variation] did not exist before it was opened
+  int compressionsettings; //-1: ROOT default, see set_compression()
   std::map<TString,std::string> regioninTables;
   TString lumi;
   TString analysis;
@@ -63,9 +211,7 @@ public:
   int debug;
   std::vector<variable*> v;
   Int_t nvar;
-  std::vector<Float_t*> address1;
-  std::vector<Double_t*> address3;
-  std::vector<Int_t*> address2;
+  std::vector<varBinding> bindings; //bindings[ivar]
   bool dataref;
   TString trexdir;
   std::vector<TString> stackorder;
@@ -74,33 +220,44 @@ public:
   TString sensitivevariable;
   TString yieldvariable;
   std::map<TString, std::map<TString, std::map<TString, std::vector<TH1D*> > > > plot_lib; //plot_lib[sample][region][variation][var]
+  std::vector<TString> weightvariations; //weight-only variations registered with add_weight_variation
+  std::vector<Float_t*> fweightvariations;
+  std::vector<Double_t*> dweightvariations;
+  std::vector<double> fanoutweights;
+  std::unordered_map<std::string, int> regionindex; //region name -> id, see findregion()
+  int nregionindexed;
+  std::vector<int> fillbins;
+  std::vector<int> fanoutregions;
+  std::vector<fillSlot> slots; //booked by book(), indexed by FillHandle::islot
+  std::map<TString, std::map<TString, std::map<TString, int> > > slot_lib; //slot_lib[sample][region][variation]
+  bool usearena; //keep the bins in one arena, TH1D are created when grabbed/written
+  HistArena *arena;
+  bool sharedbins; //arena in shared memory filled with atomic adds, see share_bins()
   std::vector<TString> regions;
   std::vector<fcncSample> samples;
   std::vector<TString> mutedregions;
+  std::vector<regionVariables> regionvariables; //see set_region_variables()
+  std::map<TString, std::vector<int>> activevarcache;
+  std::unordered_set<const std::vector<TH1D*>*> fillbooked; //plot_lib entries made by the fill methods, see bookedhist()
   static TFile *bufferfile;
   histSaver(TString outputfilename);
   virtual ~histSaver();
   void clearhist();
   template<typename D>
   void add(variable* v_, D* var_ = 0){
-    v.push_back(v_);
-    TString Dname = typeid(*var_).name();
-    if(debug) printf("fill type: %s\n", Dname.Data());
-    address1.push_back(0);
-    address2.push_back(0);
-    address3.push_back(0);
-    if(var_){
-      if (Dname.Contains("i")) 
-        address2[v.size()-1] = (int*)var_;
-      else if(Dname.Contains("f")) 
-        address1[v.size()-1] = (float*)var_;
-      else if(Dname.Contains("d"))
-        address3[v.size()-1] = (double*)var_;
-      else
-        printf("unknown var type: %s\n", v_->name.Data());
-    }
+    add(v_);
+    if(var_) bind(v.size()-1, var_);
   }
-  void add(variable* v_){v.push_back(v_);}
+  void add(variable* v_, std::function<double()> expression); //derived quantity computed at fill time
+  void add(variable* v_){v.push_back(v_); bindings.push_back(varBinding(v_));}
+  template<typename D>
+  void bind(int ivar, D* var_){
+    static_assert(std::is_arithmetic<D>::value, "histSaver::bind() : variable must be bound to an arithmetic type");
+    bindings.at(ivar).address = var_;
+    bindings.at(ivar).read = &readBinding<D>;
+    bindings.at(ivar).type = typeid(D).name();
+  }
+  void bind(int ivar, std::function<double()> expression);
   void show();
   bool find_sample(TString sample);
   TH1D* grabbkghist(TString region, int ivar);
@@ -116,12 +273,27 @@ public:
   void scale_sample(TString scaleregion, std::string formula, TString scaleVariable, std::vector<observable> scalefactor, std::vector<double> slices = {}, TString variation = "NOMINAL");
   int findvar(TString varname);
   std::vector<int> resolveslices(TH1D* target, const std::vector<double>* slices);
+  bool linearfit; //fit_scale_factor solves the linear least squares directly, Minuit only for out of range results
   std::map<TString,std::vector<observable>>* fit_scale_factor(std::vector<TString> *fit_regions, TString *variable, std::vector<TString> *scalesamples, const std::vector<double> *slices, TString *variation, std::vector<TString> *postfit_regions);
   std::map<TString,std::vector<observable>>* fit_scale_factor(std::vector<TString> *fit_regions, TString *variable, std::map<TString,std::map<TString,std::vector<TString>>> *scalesamples, const std::vector<double> *slices, TString *variation = 0, std::map<TString,std::map<TString,std::vector<TString>>> *postfit_regions = 0);
+  //every slice of every variation fitted in parallel (nthreads <= 0: all cores), result[variation] as fit_scale_factor() returns,
+  //a variation without data or background histograms in the fit regions is reported, not fitted and has no result
+  //(fit_scale_factor() returns 0 for it)
+  std::map<TString,std::map<TString,std::vector<observable>>> fit_scale_factors(std::vector<TString> *fit_regions, TString *variable, std::map<TString,std::map<TString,std::vector<TString>>> *scalesamples, const std::vector<double> *slices, std::vector<TString> variations, int nthreads = 0, std::map<TString,std::map<TString,std::vector<TString>>> *postfit_regions = 0);
   void muteregion(TString region);
   void unmuteregion(TString region);
+  //only book/fill/plot these variables in regions whose name contains regionpattern (or is one of regions),
+  //regions matching no rule keep all variables. Call after add() and before filling.
+  void set_region_variables(TString regionpattern, std::vector<TString> varnames);
+  void set_region_variables(std::vector<TString> regions, std::vector<TString> varnames);
+  const std::vector<int>& activevars(TString region);
+  bool isactive(TString region, int ivar);
+  int yieldvar(TString region); //variable for yields and existence checks: yieldvariable if active in the region, else the first active one, -1 if none
   void SetLumiAnaWorkflow(TString _lumi, TString _analysis, TString _workflow);
   void write_trexinput(TString NPname = "NOMINAL", TString writename = "", TString writeoption = "update");
+  //all variations in one pass, each output file is opened once. consolidated: a single file trexdir.root
+  //with the directories variable/region/sample instead of one file per (variable, region, sample)
+  void write_trexinput(std::vector<TString> NPnames, std::vector<TString> writenames = {}, TString writeoption = "update", bool consolidated = 0);
   void overlay(TString _overlaysample);
   TH1D* grabhist_int(TString sample, TString region, int ivar, bool vital = 0);
   TH1D* grabhist(TString sample, TString region, TString variation, int ivar, bool vital = 0);
@@ -130,18 +302,140 @@ public:
   void merge_regions(TString inputregion1, TString inputregion2, TString outputregion);
   void merge_regions(std::vector<TString> inputregions, TString outputregion);
   Float_t getVal(Int_t i);
+  Float_t clampVal(Int_t i, Float_t val);
   float binwidth(int i);
   void read_sample(TString samplename, TString savehistname, TString NPname, TString sampleTitle, enum EColor color, double norm, TFile *_inputfile=0, bool applyVariation=1);
+  void read_samples(std::vector<sampleRead> &reads, int nthreads = 0); //one reader thread per input file
+  std::map<TFile*, fileIndex> keyindex;
+  void indexkeys(TFile *file);
+  void forgetfile(TFile *file); //drops the index (and cache) of an input file that is not read any more
+  TH1D* readhist(TFile *file, TString histname); //owned by the caller, 0 if not in the file
+  TFile* readfile(TFile *_inputfile);
+  TString readhistname(TFile *file, TString savehistname, TString variation, TString region, bool applyVariation);
+  void add_read(TString samplename, TString variation, TString sampleTitle, enum EColor color, double norm, TString region, int ivar, TString histname, TH1D *readhist);
+  //read_sample/read_samples only register the file and the histogram names, grabhist() reads a histogram the first time
+  //it is asked for. The input files have to stay open. write(), dump_cache() and complete() load everything left (load_lazy()).
+  bool lazyread;
+  std::map<TString, std::map<TString, std::map<TString, std::vector<lazySource>>>> lazy_lib; //lazy_lib[sample][region][variation]
+  void loadlazy(TString sample, TString region, TString variation, int ivar);
+  void load_lazy();
+  bool usecache; //read_sample reads input files through <input>.hcache, (re)written when older than the input
+  void write_filecache(TFile *file, TString cachename);
+  void dump_cache(TString filename); //all histograms of plot_lib and the samples, reload with load_cache()
+  bool load_cache(TString filename);
+  void merge_cache(HistCache &cache, bool add); //add: add the histograms to plot_lib instead of replacing them
+  //incremental filling: if(begin_input(file, cuts_version)) { ...fill the events of file...; end_input(); }
+  //the histograms filled from an input are kept in partialdir per (input content, configuration),
+  //begin_input() returns 0 and adds the kept histograms when neither changed since they were written.
+  //Between begin_input() and end_input() plot_lib only holds what the input filled: the histograms filled before are
+  //moved aside and added back in end_input(), the same addition as for a kept partial.
+  //Expressions bound with add()/bind() are not part of the fingerprint, change config when they change.
+  TString partialdir;
+  TString partialname; //partial of the input being filled, "" outside begin_input()/end_input()
+  std::vector<std::pair<std::vector<TH1D*>*, std::vector<TH1D*>>> partialbase; //plot_lib entry, its histograms before begin_input()
+  bool begin_input(TString inputname, TString config = "");
+  void end_input();
+  TString fingerprint(TString config); //variables, binning, bound types, regions, samples, weight variations and config
+  unsigned long long inputhash(TString inputname); //content hash, remembered per (path, size, mtime) in partialdir
   void plot_stack(TString NPname,TString outputdir = ".",TString outputchartdir = ".");
   void fill_hist(TString sample, TString region, TString variation);
   void fill_hist(TString sample, TString region);
+  FillHandle book(TString sample, TString region, TString variation = "NOMINAL");
+  void fill_hist(FillHandle handle);
+  //weight-only variations: the bin of every variable is found once and filled with each weight
+  void add_weight_variation(TString variation, Float_t* _weight);
+  void add_weight_variation(TString variation, Double_t* _weight);
+  //one value and bin computation per event for all the regions it belongs to
+  int findregion(TString region);
+  //id based access for post-processing loops: sampleid()/findregion()/variationid() once, then grabhist(ids).
+  //The TString grab functions go through the same index. Data is not redirected to NOMINAL by the id overloads.
+  nameIndex sampleids;
+  nameIndex variationids;
+  std::unordered_map<std::string, int> varindex; //variable name -> ivar, see varid()
+  std::unordered_map<unsigned long long, std::pair<std::vector<TH1D*>*, int>> histindex; //ids -> (plot_lib entry, slot or -1)
+  int sampleid(TString sample){ return sampleids.intern(sample); }
+  int variationid(TString variation){ return variationids.intern(variation); }
+  int varid(TString varname); //-1 if not found
+  static unsigned long long histkey(int isample, int iregion, int ivariation){
+    return ((unsigned long long)isample << 42) | ((unsigned long long)iregion << 21) | (unsigned long long)ivariation;
+  }
+  std::pair<std::vector<TH1D*>*, int>* histentry(int isample, int iregion, int ivariation); //0 if not in plot_lib
+  TH1D* grabhist(int isample, int iregion, int ivariation, int ivar, bool vital = 0);
+  std::vector<TH1D*>* grabhists(int isample, int iregion, int ivariation);
+  RegionHandle book_regions(TString sample, TString variation = "NOMINAL");
+  void fill_hist(RegionHandle &handle, ULong64_t regionmask); //bit i: region id i, for up to 64 regions
+  void fill_hist(RegionHandle &handle, const std::vector<int> &regionids);
+  void fill_hist(RegionHandle &handle, BelongRegion &belongregion);
+  FanoutHandle book_fanout(TString sample, TString region, TString nominal = "NOMINAL");
+  FanoutHandle book_fanout(TString sample, TString region, TString nominal, std::vector<TString> variations);
+  void fill_hist(const FanoutHandle &handle);
+  void fill_hist(const FanoutHandle &handle, const double *weights);
+  //columnar filling: values[ivar] points to nevents values of variable ivar
+  void fill_batch(FillHandle handle, const std::vector<const float*> &values, const double *weights, long nevents);
+  void fill_batch(FillHandle handle, const std::vector<const double*> &values, const double *weights, long nevents);
+  void fill_batch(TString sample, TString region, TString variation, const std::vector<const float*> &values, const double *weights, long nevents);
+  void fill_batch(TString sample, TString region, TString variation, const std::vector<const double*> &values, const double *weights, long nevents);
+  void fill_batch(FillHandle handle, const std::vector<const int*> &values, const double *weights, long nevents); //integer columns, not scaled
+  void fill_batch(TString sample, TString region, TString variation, const std::vector<const int*> &values, const double *weights, long nevents);
+  template<typename T>
+  void fill_columns(FillHandle handle, const std::vector<const T*> &values, const double *weights, long nevents);
   void add_region(TString region);
   void add_sample(TString samplename, TString sampleTitle, enum EColor color);
   void init_hist(std::map<TString,std::map<TString,std::map<TString,std::vector<TH1D*>>>>::iterator sample_lib, TString region, TString variation);
+  TH1D* newhist(TString sample, TString region, TString variation, int ivar);
+  //hists[ivar] of a plot_lib entry, for entries made by the fill methods a histogram without fill is created empty here
+  TH1D* bookedhist(std::vector<TH1D*> &hists, TString sample, TString region, TString variation, int ivar);
+  bool slotbins(fillSlot &slot, int ivar, double *&sumw, double *&sumw2, bool create); //false if not allocated and !create
+  //moves the arena of all booked slots to shared memory: processes forked afterwards fill the same bins,
+  //seen by the parent with sync_slots() once they finished. Every slot has to be booked before, the blocks
+  //of all active variables are allocated here as pages allocated later would be private to one process.
+  //Workers should fill through the FillHandles from book(): fill_hist(TString...) books on its way and
+  //an entry not booked before share_bins() ends the worker with exit(1).
+  void share_bins();
+  void addbin(double *sumw, double *sumw2, int bin, double weight){
+    if(sharedbins){
+      atomic_add(sumw+bin, weight);
+      atomic_add(sumw2+bin, weight*weight);
+    }else{
+      sumw[bin] += weight;
+      sumw2[bin] += weight*weight;
+    }
+  }
+  void addentries(fillSlot &slot, double n){
+    if(slot.completed) checkcompleted(slot.sample, slot.variation);
+    if(slot.sharedentries) atomic_add(slot.sharedentries, n);
+    else slot.entries += n;
+  }
+  std::vector<TH1D*>* grabhists(TString sample, TString region, TString variation); //0 if not booked, entries are 0 until filled
+  int findslot(TString sample, TString region, TString variation);
+  void sync_slot(int islot, int ivar = -1); //ivar >= 0: only that variable gets a histogram, the others stay in the arena
+  void sync_slots();
+  void add_to_slot(int islot, double **sumw, double **sumw2, double entries);
+  void merge_shard(FillShard *shard);
+  void merge_shards(std::vector<FillShard*> shards);
+  void fill_parallel(Long64_t nentries, int nthreads, std::function<void(FillShard*, int, Long64_t, Long64_t)> fillrange, int nchunks = 64);
+  //the same callback as fill_parallel(), but all threads add to the one set of bins with atomic adds (direct shards):
+  //no per-thread copies, all blocks of the booked slots are allocated first. The summation order depends on the scheduling.
+  void fill_atomic(Long64_t nentries, int nthreads, std::function<void(FillShard*, int, Long64_t, Long64_t)> fillrange, int nchunks = 64);
 
   void set_weight(Float_t* _weight){ fweight = _weight; weight_type = 1;}
   void set_weight(Double_t* _weight){ dweight = _weight; weight_type = 2;}
-  void write();
+  void write(int nthreads = 1); //one thread per variation file, nthreads <= 0: all cores
+  int writehists(TFile *file, std::vector<TH1D*> &hists, Option_t *option); //one plot_lib[sample][region][variation], returns the number written
+  //finished variation/sample: its histograms are written on a background thread and deleted, the file of a complete
+  //variation is closed. plot_lib keeps the entries as unallocated histograms, later fills of them are an error.
+  //Arena blocks (usearena) are not returned, only the histograms created from them.
+  void complete_variation(TString variation);
+  void complete_sample(TString sample);
+  void complete(TString sample, TString variation); //"" matches all
+  void checkcompleted(TString sample, TString variation);
+  bool iscompleted(TString sample, TString variation);
+  BackgroundWriter *writer; //created by the first complete_variation()/complete_sample()
+  std::vector<TString> completedvariations;
+  std::vector<TString> completedsamples;
+  TFile* openoutput(TString variation, TString option = "update"); //waits for the background writer, which may hold the file
+  //e.g. kLZ4 for scratch outputs, kZSTD for archival. Applies to the open output files and the ones opened later
+  void set_compression(ROOT::RCompressionSetting::EAlgorithm::EValues algorithm, int level);
   // hadhad FF
   void FakeFactorMethod(TString final_region, TString _1m1lregion,TString _1l1mregion,TString _1l1nregion,TString _1n1lregion,TString _2nregion,TString variation,TString newsamplename,TString newsampletitle,std::vector<TString> tmp_regions,enum EColor color,bool SBplot);
   void FakeFactorMethod(TString final_region, TString _1m1lnmregion,TString _1lnm1mregion,TString _2nregion,TString variation,TString newsamplename,TString newsampletitle,std::vector<TString> tmp_regions,enum EColor color,bool SBplot);
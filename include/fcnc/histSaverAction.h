@@ -0,0 +1,77 @@
+#ifndef HISTSAVERACTION
+#define HISTSAVERACTION
+
+#include "histSaver.h"
+#include "FillShard.h"
+#include "TROOT.h"
+#include "ROOT/RDF/RActionImpl.hxx"
+#include <memory>
+#include <string>
+
+//RDataFrame action filling one sample/variation of a histSaver, to be booked as
+//  histSaverAction action(saver, df.GetNSlots(), "ttbar", "NOMINAL");
+//  auto result = df.Book<ULong64_t, double, float, float>(std::move(action), {"regionmask", "weight", "var1", "var2"});
+//The columns are: the region bit mask (bit i: histSaver::regions[i]), the event weight, then one column per
+//variable in the order they were added, variable::scale is applied to the floating point ones. nslots has to be the
+//GetNSlots() of the dataframe the action is booked on. Each processing slot fills its own FillShard, the shards are merged
+//into the histSaver in slot order when the event loop ends, then histSaver::write() can be called as usual.
+class histSaverAction : public ROOT::Detail::RDF::RActionImpl<histSaverAction>
+{
+public:
+  using Result_t = histSaver;
+  histSaver *saver;
+  TString sample;
+  TString variation;
+  std::vector<FillHandle> handles; //handles[iregion]
+  ULong64_t regionbits; //mask bits that have a region
+  std::vector<std::unique_ptr<FillShard>> shards; //shards[islot]
+  std::vector<std::vector<double>> values; //values[islot][ivar]
+
+  histSaverAction(histSaver *_saver, unsigned nslots, TString _sample, TString _variation = "NOMINAL"):
+  saver(_saver), sample(_sample), variation(_variation)
+  {
+    //book everything here: histSaver::book() is not thread safe
+    for(auto region : saver->regions) handles.push_back(saver->book(sample, region, variation));
+    regionbits = handles.size() >= 64 ? ~0ULL : (1ULL << handles.size()) - 1;
+    for (unsigned islot = 0; islot < nslots; ++islot){
+      shards.emplace_back(new FillShard(saver));
+      values.emplace_back(saver->v.size());
+    }
+  }
+  histSaverAction(histSaverAction &&) = default;
+  histSaverAction(const histSaverAction &) = delete;
+
+  std::shared_ptr<histSaver> GetResultPtr() const { return std::shared_ptr<histSaver>(std::shared_ptr<histSaver>(), saver); } //not owned
+  void Initialize() {}
+  void InitTask(TTreeReader *, unsigned int islot) {
+    if(islot >= shards.size()) {
+      printf("histSaverAction::InitTask() ERROR: processing slot %u, the action was created for %lu slots, pass df.GetNSlots()\n", islot, shards.size());
+      exit(0);
+    }
+  }
+
+  template<typename... Vars>
+  void Exec(unsigned int islot, ULong64_t regionmask, double weight, const Vars&... vars){
+    if(sizeof...(Vars) != saver->v.size()) {
+      printf("histSaverAction::Exec() ERROR: %lu variable columns booked, %lu variables defined\n", sizeof...(Vars), saver->v.size());
+      exit(0);
+    }
+    if(!regionmask) return;
+    if(regionmask & ~regionbits) {
+      printf("histSaverAction::Exec() ERROR: region mask 0x%llx has bit %d set, %lu regions defined\n", regionmask, 63 - __builtin_clzll(regionmask), handles.size());
+      exit(0);
+    }
+    std::vector<double> &val = values[islot];
+    int ivar = 0;
+    (void)std::initializer_list<int>{(val[ivar] = scaledValue(vars, saver->v[ivar]->scale), ++ivar)...};
+    for (int ireg = 0; regionmask; ++ireg, regionmask >>= 1)
+      if(regionmask & 1) shards[islot]->fill_scaled(handles[ireg], val.data(), weight);
+  }
+
+  void Finalize(){
+    for(auto &shard : shards) saver->merge_shard(shard.get());
+  }
+
+  std::string GetActionName() { return "histSaverAction"; }
+};
+#endif
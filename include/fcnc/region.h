@@ -1,3 +1,5 @@
+#ifndef BELONGREGION
+#define BELONGREGION
 #include "iostream"
 #include "TString.h"
 #include <map>
@@ -19,4 +21,5 @@ public:
 	bool isEnabled(TString region);
 	void enable(TString region);
 	void enable(std::vector<TString> regions);
-};
\ No newline at end of file
+};
+#endif
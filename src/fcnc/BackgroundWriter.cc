@@ -0,0 +1,51 @@
+#include "BackgroundWriter.h"
+using namespace std;
+
+BackgroundWriter::BackgroundWriter() :
+running(0), stop(0)
+{
+  worker = thread(&BackgroundWriter::loop, this);
+}
+
+BackgroundWriter::~BackgroundWriter(){
+  {
+    lock_guard<mutex> guard(lock);
+    stop = 1;
+  }
+  changed.notify_all();
+  worker.join();
+}
+
+void BackgroundWriter::push(function<void()> job){
+  {
+    lock_guard<mutex> guard(lock);
+    jobs.push_back(job);
+  }
+  changed.notify_all();
+}
+
+void BackgroundWriter::wait(){
+  unique_lock<mutex> guard(lock);
+  changed.wait(guard, [this](){ return jobs.empty() && !running; });
+}
+
+int BackgroundWriter::pending(){
+  lock_guard<mutex> guard(lock);
+  return jobs.size() + running;
+}
+
+void BackgroundWriter::loop(){
+  unique_lock<mutex> guard(lock);
+  for(;;){
+    changed.wait(guard, [this](){ return stop || !jobs.empty(); });
+    if(jobs.empty()) return; //stop requested and nothing left
+    function<void()> job = jobs.front();
+    jobs.pop_front();
+    running = 1;
+    guard.unlock();
+    job();
+    guard.lock();
+    running = 0;
+    changed.notify_all();
+  }
+}
@@ -0,0 +1,119 @@
+#include "FillShard.h"
+#include "histSaver.h"
+#include "fillkernel.h"
+
+FillShard::FillShard(histSaver *_saver, bool _direct) :
+saver(_saver), direct(_direct)
+{
+}
+
+FillShard::~FillShard(){
+}
+
+void FillShard::allocate(int islot){
+  if(islot >= saver->slots.size()) {
+    printf("FillShard::fill() ERROR: invalid fill handle %d, call histSaver::book() before filling shards\n", islot);
+    exit(0);
+  }
+  if(sumw.size() <= islot){
+    sumw.resize(islot+1);
+    sumw2.resize(islot+1);
+    entries.resize(islot+1,0);
+  }
+  sumw[islot].resize(saver->v.size(),0);
+  sumw2[islot].resize(saver->v.size(),0);
+  for (int i : saver->slots[islot].ivars){
+    if(direct){
+      //allocated by histSaver::fill_atomic() before the threads started
+      if(!saver->slotbins(saver->slots[islot], i, sumw[islot][i], sumw2[islot][i], 0)) {
+        printf("FillShard::fill() ERROR: slot %d is not allocated, direct shards are filled through histSaver::fill_atomic()\n", islot);
+        exit(0);
+      }
+      continue;
+    }
+    int nbins = saver->v.at(i)->nbins;
+    double *bins = arena.allocate(2*(nbins+2));
+    sumw[islot][i] = bins;
+    sumw2[islot][i] = bins+nbins+2;
+  }
+}
+
+template<typename T>
+void FillShard::fillvalues(FillHandle handle, const T *values, double weight, bool scale){
+  if(handle.islot >= sumw.size() || !sumw[handle.islot].size()) allocate(handle.islot);
+  if(saver->slots[handle.islot].completed) saver->checkcompleted(saver->slots[handle.islot].sample, saver->slots[handle.islot].variation);
+  double **w = sumw[handle.islot].data();
+  double **w2 = sumw2[handle.islot].data();
+  for (int i : saver->slots[handle.islot].ivars){
+    variable *var = saver->v[i];
+    int bin = var->findbin(saver->clampVal(i, scale ? scaledValue(values[i], var->scale) : values[i]));
+    if(direct){
+      atomic_add(w[i]+bin, weight);
+      atomic_add(w2[i]+bin, weight*weight);
+      continue;
+    }
+    w[i][bin] += weight;
+    w2[i][bin] += weight*weight;
+  }
+  entries[handle.islot] += 1;
+}
+
+void FillShard::fill(FillHandle handle, const double *values, double weight){
+  fillvalues(handle, values, weight);
+}
+
+void FillShard::fill(FillHandle handle, const float *values, double weight){
+  fillvalues(handle, values, weight);
+}
+
+void FillShard::fill(FillHandle handle, const int *values, double weight){
+  fillvalues(handle, values, weight);
+}
+
+void FillShard::fill_scaled(FillHandle handle, const double *values, double weight){
+  fillvalues(handle, values, weight, 0);
+}
+
+template<typename T>
+void FillShard::fill_columns(FillHandle handle, const std::vector<const T*> &values, const double *weights, long nevents){
+  if(values.size() != saver->v.size()) {
+    printf("FillShard::fill_batch() ERROR: %lu columns given for %lu variables\n", values.size(), saver->v.size());
+    exit(0);
+  }
+  if(handle.islot >= sumw.size() || !sumw[handle.islot].size()) allocate(handle.islot);
+  if(saver->slots[handle.islot].completed) saver->checkcompleted(saver->slots[handle.islot].sample, saver->slots[handle.islot].variation);
+  for (int i : saver->slots[handle.islot].ivars){
+    binRange range(saver->v[i]);
+    if(!direct) {
+      fill_column(range, values[i], weights, nevents, sumw[handle.islot][i], sumw2[handle.islot][i]);
+      continue;
+    }
+    int nbins = range.nbins;
+    local.assign(2*(nbins+2), 0);
+    fill_column(range, values[i], weights, nevents, local.data(), local.data()+nbins+2);
+    for (int ib = 0; ib < nbins+2; ++ib) if(local[ib] != 0 || local[nbins+2+ib] != 0) {
+      atomic_add(sumw[handle.islot][i]+ib, local[ib]);
+      atomic_add(sumw2[handle.islot][i]+ib, local[nbins+2+ib]);
+    }
+  }
+  entries[handle.islot] += nevents;
+}
+
+void FillShard::fill_batch(FillHandle handle, const std::vector<const float*> &values, const double *weights, long nevents){
+  fill_columns(handle, values, weights, nevents);
+}
+
+void FillShard::fill_batch(FillHandle handle, const std::vector<const double*> &values, const double *weights, long nevents){
+  fill_columns(handle, values, weights, nevents);
+}
+
+void FillShard::fill_batch(FillHandle handle, const std::vector<const int*> &values, const double *weights, long nevents){
+  fill_columns(handle, values, weights, nevents);
+}
+
+void FillShard::clear(){
+  sumw.clear();
+  sumw2.clear();
+  entries.clear();
+  arena.clear();
+}
@@ -1,12 +1,66 @@
 #include "HISTFITTER.h"
+#include "Eigen/Dense"
+#include "Minuit2/FCNGradientBase.h"
+#include "Minuit2/MnUserParameters.h"
+#include "Minuit2/MnMigrad.h"
+#include "Minuit2/MnScan.h"
+#include "Minuit2/FunctionMinimum.h"
+#include "TSystem.h"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <unistd.h>
 using namespace std;
-TMinuit* gM = 0;
+using namespace ROOT::Minuit2;
+
+//chi2 of one HISTFITTER, nothing global: fits of different HISTFITTER instances can run in parallel
+class fitObjective : public FCNBase
+{
+public:
+	fitObjective(fitModel *_model) : model(_model) {}
+	fitModel *model;
+	double operator()(const vector<double> &par) const { return model->chi2(par.data()); }
+	double Up() const { return 1; }
+};
+
+class fitGradientObjective : public FCNGradientBase
+{
+public:
+	fitGradientObjective(fitModel *_model) : model(_model) {}
+	fitModel *model;
+	double operator()(const vector<double> &par) const { return model->chi2(par.data()); }
+	vector<double> Gradient(const vector<double> &par) const {
+		vector<double> grad(par.size(), 0);
+		model->chi2(par.data(), grad.data());
+		return grad;
+	}
+	bool CheckGradient() const { return false; }
+	double Up() const { return 1; }
+};
+
+//scan the last parameter, then MIGRAD from the best point with 1000 calls and tolerance 0.1
+template<typename FCN>
+FunctionMinimum scanmigrad(const FCN &objective, const MnUserParameters &parameters){
+	//as the TMinuit "SCAN nparam 60" before: 60 points of the last parameter only, the best one is kept
+	MnScan scan(objective, parameters);
+	scan.Scan(parameters.Params().size()-1, 60);
+	MnMigrad migrad(objective, scan.State());
+	return migrad(1000, 0.1);
+}
 
 HISTFITTER::HISTFITTER(){
 	nparam = 0;
 	htot = NULL;
 	debug = 1;
 	nregion = 100;
+	analyticgradient = 0;
+	linearsolve = 0;
+	comparelinear = 0;
+	nlinearstep = 10;
+	nlinear = 0;
+	nminuit = 0;
+	toyseed = 0;
+	ntoy = 0;
 }
 HISTFITTER::~HISTFITTER(){
 	for (iter = fithists.begin(); iter != fithists.end(); iter ++){
@@ -40,6 +94,7 @@ void HISTFITTER::addfithist(TString component,  TH1D* inputhist, int begin, int
 	if ( fithists.find(component) == fithists.end() )
 	{
 		fithists[component] = new TH1D(component, component, nregion, 0, nregion);
+		fithists[component]->SetDirectory(0); //fitters in different threads use the same names
 	}
 	if(fit){
 		int nfit = 0;
@@ -65,8 +120,11 @@ void HISTFITTER::addfithist(TString component,  TH1D* inputhist, int begin, int
 }
 void HISTFITTER::calculateEigen(){
 
-	double covariance_matrix[100];
-	gM->mnemat(&covariance_matrix[100],nparam);
+	if(covariance.size() != nparam*nparam) {
+		printf("HISTFITTER::calculateEigen() ERROR: no covariance matrix, call fit() first\n");
+		exit(0);
+	}
+	double *covariance_matrix = covariance.data();
 	if(debug){
 		for (int i = 0; i < nparam; ++i){
 			printf("covariance matrix: ");
@@ -112,64 +170,184 @@ void HISTFITTER::calculateEigen(){
 	delete[] eigenval;
 	
 }
-void HISTFITTER::fcn(Int_t &npar, Double_t *gin, Double_t &f, Double_t *par, Int_t iflag) {
-	f = 0;
-	map<TString, TH1D*>* histforfit = (map<TString, TH1D*>*) gM->GetObjectFit();
-	if (!histforfit)
-	{
-	   printf("hist isn't found\n");
-	   exit(1);
-	}	
-	map<TString, TH1D*>::iterator iter;
-	
-	TH1D *htot = NULL;
-	TH1D *data = NULL;
-	for (iter = histforfit->begin(); iter != histforfit->end(); iter ++)
+void fitModel::compile(map<TString, TH1D*> &fithists){
+	TH1D *datahist = NULL;
+	auto asimov = fithists.find("asimovdata");
+	if(asimov != fithists.end()) datahist = asimov->second;
+	else if(fithists.find("data") != fithists.end()) datahist = fithists["data"];
+	vector<TH1D*> components;
+	vector<int> componentpar;
+	for (auto iter = fithists.begin(); iter != fithists.end(); iter ++)
 	{
-		if(iter->first == "metadata") continue;
-		if(histforfit->find("asimovdata")!=histforfit->end()){
-			if(iter->first == "data") {
-				continue;
-			}
-			if (iter->first == "asimovdata")
-			{
-				data = iter->second;
-				continue;
-			}
-		}else{
-			if (iter->first == "data")
-			{
-				data = iter->second;
-				continue;
-			}
-		}
-		int ipar = parsecomponentname(iter->first);
-		double histscale = ipar >=0? par[ipar] : 1;
-		if (!htot)
-		{
-			htot = (TH1D*)iter->second->Clone("htotfcn");
-			htot->Scale(histscale);
-		}else
-			htot->Add(iter->second,histscale);
+		if(iter->first == "metadata" || iter->first == "data" || iter->first == "asimovdata") continue;
+		components.push_back(iter->second);
+		componentpar.push_back(HISTFITTER::parsecomponentname(iter->first));
 	}
-
-	if(!htot) {
+	if(!components.size()) {
 		printf("HISTFITTER::fcn() : ERROR: htot is empty, please check if histforfit has histograms:\n");
-		for (auto hist: *histforfit)
+		for (auto hist: fithists)
 		{
 			printf(" %s ", hist.first.Data());
 		}
 		exit(0);
 	}
-	if(!data) {
-          printf("ERROR: data histogram doesn't exist\n");
-          exit(0);
-        }
-	for (int i = 1; i <= data->GetNbinsX(); ++i){
-		if(htot->GetBinContent(i))
-			f += pow((data->GetBinContent(i) - htot->GetBinContent(i))/htot->GetBinError(i),2);
+	if(!datahist) {
+		printf("ERROR: data histogram doesn't exist\n");
+		exit(0);
+	}
+	vector<int> bins;
+	for (int i = 1; i <= datahist->GetNbinsX(); ++i){
+		for(auto hist : components)
+			if(hist->GetBinContent(i)) {
+				bins.push_back(i);
+				break;
+			}
+	}
+	nbin = bins.size();
+	ncomp = 0;
+	ipar.clear();
+	sumw.clear();
+	err2.clear();
+	fixedsumw.assign(nbin, 0);
+	fixederr2.assign(nbin, 0);
+	data.resize(nbin);
+	total.resize(nbin);
+	var.resize(nbin);
+	for (int b = 0; b < nbin; ++b) data[b] = datahist->GetBinContent(bins[b]);
+	for (int c = 0; c < components.size(); ++c){
+		if(componentpar[c] < 0) {
+			for (int b = 0; b < nbin; ++b){
+				fixedsumw[b] += components[c]->GetBinContent(bins[b]);
+				fixederr2[b] += pow(components[c]->GetBinError(bins[b]),2);
+			}
+			continue;
+		}
+		ipar.push_back(componentpar[c]);
+		for (int b = 0; b < nbin; ++b){
+			sumw.push_back(components[c]->GetBinContent(bins[b]));
+			err2.push_back(pow(components[c]->GetBinError(bins[b]),2));
+		}
+		ncomp++;
+	}
+}
+
+double fitModel::chi2(const double *par, double *grad){
+	double *t = total.data();
+	double *v = var.data();
+	for (int b = 0; b < nbin; ++b){
+		t[b] = fixedsumw[b];
+		v[b] = fixederr2[b];
+	}
+	for (int c = 0; c < ncomp; ++c){
+		double scale = par[ipar[c]];
+		double scale2 = scale*scale;
+		const double *w = sumw.data() + c*nbin;
+		const double *e = err2.data() + c*nbin;
+		for (int b = 0; b < nbin; ++b){
+			t[b] += scale*w[b];
+			v[b] += scale2*e[b];
+		}
+	}
+	double f = 0;
+	for (int b = 0; b < nbin; ++b){
+		double r = data[b] - t[b];
+		f += t[b] != 0 ? r*r/v[b] : 0;
+	}
+	if(!grad) return f;
+	//d/ds_c of r^2/v: -2 r w_cb / v - 2 s_c e_cb r^2 / v^2
+	for (int c = 0; c < ncomp; ++c){
+		double scale = par[ipar[c]];
+		const double *w = sumw.data() + c*nbin;
+		const double *e = err2.data() + c*nbin;
+		double g = 0;
+		for (int b = 0; b < nbin; ++b){
+			double r = data[b] - t[b];
+			double rv = t[b] != 0 ? r/v[b] : 0;
+			g -= 2*rv*(w[b] + scale*e[b]*rv);
+		}
+		grad[ipar[c]] += g;
+	}
+	return f;
+}
+
+double fitModel::hessian(const double *par, int npar, double *grad, double *hess){
+	double f = chi2(par);
+	//per parameter: dt[k*nbin + b] = dtotal_b/ds_k, dv/ds_k = 2 s_k e2[k*nbin + b]
+	vector<double> dt(npar*nbin, 0), e2(npar*nbin, 0), u(npar);
+	for (int c = 0; c < ncomp; ++c)
+		for (int b = 0; b < nbin; ++b){
+			dt[ipar[c]*nbin + b] += sumw[c*nbin + b];
+			e2[ipar[c]*nbin + b] += err2[c*nbin + b];
+		}
+	fill(grad, grad + npar, 0.);
+	fill(hess, hess + npar*npar, 0.);
+	//a = r/v: dchi2/ds_k = -a (2 dt_k + a dv_k), d2chi2/ds_k ds_l = 2 u_k u_l / v - 2 a^2 e2_k delta_kl, u_k = dt_k + a dv_k
+	for (int b = 0; b < nbin; ++b){
+		if(total[b] == 0) continue;
+		double a = (data[b] - total[b])/var[b];
+		for (int k = 0; k < npar; ++k){
+			double dv = 2*par[k]*e2[k*nbin + b];
+			u[k] = dt[k*nbin + b] + a*dv;
+			grad[k] -= a*(2*dt[k*nbin + b] + a*dv);
+			hess[k*npar + k] -= 2*a*a*e2[k*nbin + b];
+		}
+		for (int k = 0; k < npar; ++k)
+			for (int l = 0; l < npar; ++l) hess[k*npar + l] += 2*u[k]*u[l]/var[b];
+	}
+	return f;
+}
+
+void fitModel::poissondata(unsigned long long seed, unsigned long long itoy){
+	toyRandom random(seed, itoy);
+	for (int b = 0; b < nbin; ++b){
+		double expected = fixedsumw[b];
+		for (int c = 0; c < ncomp; ++c) expected += sumw[c*nbin + b];
+		data[b] = random.poisson(expected);
+	}
+}
+
+toyRandom::toyRandom(unsigned long long seed, unsigned long long itoy) : key(mix(mix(seed) ^ itoy)), counter(0)
+{
+}
+
+unsigned long long toyRandom::mix(unsigned long long x){
+	x ^= x >> 30;
+	x *= 0xbf58476d1ce4e5b9ULL;
+	x ^= x >> 27;
+	x *= 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+double toyRandom::uniform(){
+	return ((mix(key + (++counter)*0x9e3779b97f4a7c15ULL) >> 11) + 0.5)*(1./9007199254740992.);
+}
+
+long toyRandom::poisson(double mean){
+	if(mean <= 0) return 0;
+	if(mean < 10){
+		//multiplication of uniforms
+		double limit = exp(-mean), product = uniform();
+		long k = 0;
+		while(product > limit) {
+			product *= uniform();
+			k++;
+		}
+		return k;
+	}
+	//transformed rejection with squeeze (PTRS, Hormann 1993)
+	double slam = sqrt(mean), loglam = log(mean);
+	double b = 0.931 + 2.53*slam;
+	double a = -0.059 + 0.02483*b;
+	double invalpha = 1.1239 + 1.1328/(b - 3.4);
+	double vr = 0.9277 - 3.6224/(b - 2);
+	while(1){
+		double u = uniform() - 0.5, v = uniform();
+		double us = 0.5 - fabs(u);
+		long k = floor((2*a/us + b)*u + mean + 0.43);
+		if(us >= 0.07 && v <= vr) return k;
+		if(k < 0 || (us < 0.013 && v > us)) continue;
+		if(log(v) + log(invalpha) - log(a/(us*us) + b) <= -mean + k*loglam - lgamma(k + 1.)) return k;
 	}
-	deletepointer(htot);
 }
 
 int HISTFITTER::parsecomponentname(TString name){
@@ -179,28 +357,61 @@ int HISTFITTER::parsecomponentname(TString name){
 	return -1;
 }
 
-void HISTFITTER::asimovfit(int fitnumber, TString outfile){
-	TTree *asimovFitResults = new TTree("asimovFitResults","asimovFitResults");
-	double *val, *err;
-	val = (double*)malloc(nparam*sizeof(double));
-	err = (double*)malloc(nparam*sizeof(double));
+void HISTFITTER::asimovfit(int fitnumber, TString outfile, int nthreads){
+	if(fithists.find("asimovdata")!=fithists.end()){
+		deletepointer(fithists["asimovdata"]);
+		fithists.erase("asimovdata");
+	}
+	model.compile(fithists);
+	settoyseed();
+	unsigned long long firsttoy = ntoy;
+	ntoy += fitnumber;
+	vector<double> val(fitnumber*nparam), err(fitnumber*nparam), chi2(fitnumber);
+	vector<char> linear(fitnumber);
+	auto runtoys = [&](atomic<int> &nexttoy){
+		fitModel toymodel = model;
+		vector<double> cov;
+		bool solved;
+		for(int itoy = nexttoy++; itoy < fitnumber; itoy = nexttoy++){
+			toymodel.poissondata(toyseed, firsttoy + itoy);
+			chi2[itoy] = minimize(toymodel, &val[itoy*nparam], &err[itoy*nparam], cov, solved);
+			linear[itoy] = solved;
+		}
+	};
+	atomic<int> nexttoy(0);
+	if(nthreads <= 0) nthreads = thread::hardware_concurrency();
+	if(nthreads > fitnumber) nthreads = fitnumber;
+	if(nthreads <= 1) runtoys(nexttoy);
+	else{
+		ROOT::EnableThreadSafety();
+		vector<thread> workers;
+		for (int ithread = 0; ithread < nthreads; ++ithread) workers.emplace_back(runtoys, ref(nexttoy));
+		for(auto &worker : workers) worker.join();
+	}
+	for (int itoy = 0; itoy < fitnumber; ++itoy) {
+		if(linear[itoy]) nlinear++;
+		else nminuit++;
+	}
 
+	TFile *fitresultfile = new TFile(outfile,"recreate");
+	TTree *asimovFitResults = new TTree("asimovFitResults","asimovFitResults");
+	vector<double> row(nparam);
+	double rowchi2;
 	for (int i = 0; i < nparam; ++i)
-		asimovFitResults->Branch(paramname[i],&(val[i]));
-	double chi2;
-	asimovFitResults->Branch("Chi2", &chi2);
-	for (int i = 0; i < fitnumber; ++i)
+		asimovFitResults->Branch(paramname[i],&(row[i]));
+	asimovFitResults->Branch("Chi2", &rowchi2);
+	for (int itoy = 0; itoy < fitnumber; ++itoy)
 	{
-		chi2 = fit(val,err,1);
+		copy(val.begin() + itoy*nparam, val.begin() + (itoy+1)*nparam, row.begin());
+		rowchi2 = chi2[itoy];
 		asimovFitResults->Fill();
 	}
-	TFile *fitresultfile = new TFile(outfile,"recreate");
 	asimovFitResults->Write();
 	fitresultfile->Close();
 	deletepointer(fitresultfile);
 }
 void HISTFITTER::setparam(TString _paramname, double _startpoint, double _stepsize, double _lowrange, double _highrange){
-	printf("set parameter: %s\n", _paramname.Data());
+	if(debug) printf("set parameter: %s\n", _paramname.Data());
 	paramname.push_back(_paramname);
 	startpoint.push_back(_startpoint);
 	stepsize.push_back(_stepsize);
@@ -208,74 +419,148 @@ void HISTFITTER::setparam(TString _paramname, double _startpoint, double _stepsi
 	highrange.push_back(_highrange);
 	nparam++;
 }
+void HISTFITTER::settoyseed(){
+	if(toyseed) return;
+	unsigned long long host = 0;
+	for(const char *c = gSystem->HostName(); *c; ++c) host = toyRandom::mix(host ^ *c);
+	toyseed = toyRandom::mix(host ^ toyRandom::mix(getpid() ^ toyRandom::mix(chrono::high_resolution_clock::now().time_since_epoch().count())));
+	if(!toyseed) toyseed = 1;
+	printf("HISTFITTER::settoyseed() : toyseed not set, using %llu\n", toyseed);
+}
 double HISTFITTER::fit(double *bstvl, double *error, bool asimov){
 
-	gRandom->SetSeed(0);
-	if(!gM) gM = new TMinuit(5);
-	gM->SetFCN(fcn);
-	gM->SetPrintLevel(-1);
-	
-	Double_t arglist[10];
-	Int_t ierflg = 0;
-	
-	arglist[0] = 1;
-	gM->mnexcm("SET ERR", arglist ,1,ierflg);
-
-	for (int i = 0; i < nparam; ++i)
-		gM->mnparm(i, paramname[i], startpoint[i], stepsize[i], lowrange[i], highrange[i],ierflg);
-
-	double stat = 1;
-	if (asimov)
-	{
-		if(htot == NULL)
-			for (iter = fithists.begin(); iter != fithists.end(); iter ++){
-				if(iter->first == "data" || iter->first == "asimovdata") continue;
-				if(htot == NULL) {
-					htot = (TH1D*)iter->second->Clone("htot");
-				}
-				else{
-					htot->Add(iter->second);
-				}
-			}
-		fithists["asimovdata"] = (TH1D*)(fithists["data"]->Clone("asimovdata"));
-		fithists["asimovdata"] ->Reset();
-		double tmpintegral = htot->Integral()*stat;
-		double tmpweight = 1./stat;
-		for (int i = 0; i < tmpintegral; ++i)
-		{
-			fithists["asimovdata"] -> Fill(htot->GetRandom(),tmpweight);
-		}
-	}else if(fithists.find("asimovdata")!=fithists.end()){
+	if(fithists.find("asimovdata")!=fithists.end()){
 		deletepointer(fithists["asimovdata"]);
 		fithists.erase("asimovdata");
 	}
 	//fithists["metadata"] = new TH1D("metadata","metadata",100,0,100);
 	//savemetadata(h_metadata, "nparam",nparam);
-	gM->SetObjectFit((TObject*)&fithists);
-   
-    arglist[0] = nparam;	//number of scan dimentions
-    arglist[1] = 60.; //number of scan points ,maximum 100
-    Double_t val[10],err[10];
-   
-    gM->mnexcm("SCAN", arglist ,2,ierflg);
-    for (int i = 0; i < nparam; ++i) gM->GetParameter(i,val[i],err[i]);
+	model.compile(fithists);
+	if (asimov) {
+		settoyseed();
+		model.poissondata(toyseed, ntoy++);
+	}
+	bool linear;
+	double chi2 = minimize(model, bstvl, error, covariance, linear);
+	if(linear) nlinear++;
+	else nminuit++;
+	return chi2;
+}
+
+double HISTFITTER::minimize(fitModel &fitmodel, double *bstvl, double *error, vector<double> &cov, bool &linear){
+	double chi2;
+	linear = linearsolve && solvelinear(fitmodel, bstvl, error, chi2, cov);
+	if(linear && !comparelinear) return chi2;
+	vector<double> linearval, linearerr, linearcov;
+	if(linear) {
+		linearval.assign(bstvl, bstvl + nparam);
+		linearerr.assign(error, error + nparam);
+		linearcov = cov;
+	}
+
+	MnUserParameters parameters;
 	for (int i = 0; i < nparam; ++i)
-		gM->mnparm(i, paramname[i], val[i], stepsize[i], lowrange[i], highrange[i],ierflg);
-   
-    arglist[0] = 1000; //max calls
-    arglist[1] = 0.1;	//tolerance
-	gM->mnexcm("MIGRADE", arglist ,2,ierflg);
-	for (int i = 0; i < nparam; ++i) gM->GetParameter(i,bstvl[i],error[i]);
-	bstvl = val;
-	error = err;
-	Double_t minf;
-	Double_t  	fedm;
-	Double_t  	errdef;
-	Int_t	npari;
-	Int_t	nparx;
-	Int_t	istat;
-	gM->mnstat(minf,fedm,errdef,npari,nparx,istat);
-	return minf;
+		parameters.Add(paramname[i].Data(), startpoint[i], stepsize[i], lowrange[i], highrange[i]);
+	FunctionMinimum minimum = analyticgradient ? scanmigrad(fitGradientObjective(&fitmodel), parameters) : scanmigrad(fitObjective(&fitmodel), parameters);
+	const MnUserParameterState &state = minimum.UserState();
+	for (int i = 0; i < nparam; ++i) {
+		bstvl[i] = state.Value(i);
+		error[i] = state.Error(i);
+	}
+	cov.assign(nparam*nparam, 0);
+	if(state.HasCovariance())
+		for (int i = 0; i < nparam; ++i)
+			for (int j = 0; j < nparam; ++j) cov[i*nparam + j] = state.Covariance()(i,j);
+	if(debug && !minimum.IsValid()) printf("HISTFITTER::fit() : WARNING: minimum is not valid\n");
+	if(linear) {
+		//the linear solution is kept, Minuit only checks it
+		for (int i = 0; i < nparam; ++i) {
+			printf("HISTFITTER::fit() : %s linear %f+/-%f, Minuit %f+/-%f, difference %4.2g errors\n", paramname[i].Data(), linearval[i], linearerr[i], bstvl[i], error[i], (linearval[i] - bstvl[i])/error[i]);
+			bstvl[i] = linearval[i];
+			error[i] = linearerr[i];
+		}
+		printf("HISTFITTER::fit() : chi2 linear %f, Minuit %f\n", chi2, minimum.Fval());
+		cov = linearcov;
+		return chi2;
+	}
+	return minimum.Fval();
+}
+
+bool HISTFITTER::solvelinear(fitModel &fitmodel, double *bstvl, double *error, double &chi2, vector<double> &cov){
+	int nbin = fitmodel.nbin;
+	//design matrix: column k is the sum of the components scaled by parameter k
+	Eigen::MatrixXd design = Eigen::MatrixXd::Zero(nbin, nparam);
+	Eigen::VectorXd target(nbin);
+	for (int c = 0; c < fitmodel.ncomp; ++c)
+		for (int b = 0; b < nbin; ++b) design(b, fitmodel.ipar[c]) += fitmodel.sumw[c*nbin + b];
+	for (int b = 0; b < nbin; ++b) target(b) = fitmodel.data[b] - fitmodel.fixedsumw[b];
+	vector<double> par(startpoint.begin(), startpoint.end());
+	Eigen::MatrixXd normal(nparam, nparam);
+	Eigen::VectorXd weights(nbin);
+	Eigen::LDLT<Eigen::MatrixXd> solver;
+	for (int istep = 0; istep < nlinearstep; ++istep)
+	{
+		fitmodel.chi2(par.data()); //fills fitmodel.total and fitmodel.var at par
+		for (int b = 0; b < nbin; ++b) weights(b) = fitmodel.total[b] != 0 && fitmodel.var[b] > 0 ? 1./fitmodel.var[b] : 0;
+		normal = design.transpose()*weights.asDiagonal()*design;
+		solver.compute(normal);
+		if(solver.info() != Eigen::Success || !solver.isPositive() || (normal.diagonal().array() <= 0).any()) {
+			if(debug) printf("HISTFITTER::solvelinear() : singular normal equations, fit with Minuit\n");
+			return 0;
+		}
+		Eigen::VectorXd solution = solver.solve(design.transpose()*weights.asDiagonal()*target);
+		double change = 0;
+		for (int k = 0; k < nparam; ++k){
+			change = max(change, fabs(solution(k) - par[k])/(1 + fabs(par[k])));
+			par[k] = solution(k);
+		}
+		if(change < 1e-8) break;
+	}
+	//the fixed variance solution above is not the minimum of the chi2, whose variance also depends on the parameters:
+	//Newton steps on the exact chi2 from there, halved while the chi2 does not decrease
+	vector<double> grad(nparam), hess(nparam*nparam), trial(nparam);
+	double f = fitmodel.hessian(par.data(), nparam, grad.data(), hess.data());
+	Eigen::Map<Eigen::MatrixXd> hessian(hess.data(), nparam, nparam);
+	Eigen::Map<Eigen::VectorXd> gradient(grad.data(), nparam);
+	bool converged = 0;
+	for (int istep = 0; ; ++istep)
+	{
+		solver.compute(hessian);
+		if(solver.info() != Eigen::Success || !solver.isPositive() || (hessian.diagonal().array() <= 0).any()) {
+			if(debug) printf("HISTFITTER::solvelinear() : chi2 not convex at the solution, fit with Minuit\n");
+			return 0;
+		}
+		if(istep == nlinearstep || converged) break;
+		Eigen::VectorXd step = -solver.solve(gradient);
+		double ftrial = f;
+		for (int ihalf = 0; ihalf < 30; ++ihalf, step /= 2){
+			for (int k = 0; k < nparam; ++k) trial[k] = par[k] + step(k);
+			ftrial = fitmodel.chi2(trial.data());
+			if(ftrial <= f) break;
+		}
+		if(ftrial > f) break;
+		double change = 0;
+		for (int k = 0; k < nparam; ++k) change = max(change, fabs(step(k))/(1 + fabs(par[k])));
+		par = trial;
+		f = fitmodel.hessian(par.data(), nparam, grad.data(), hess.data());
+		converged = change < 1e-10;
+	}
+	for (int k = 0; k < nparam; ++k){
+		if(par[k] < lowrange[k] || par[k] > highrange[k]) {
+			if(debug) printf("HISTFITTER::solvelinear() : %s = %f outside [%f, %f], fit with Minuit\n", paramname[k].Data(), par[k], lowrange[k], highrange[k]);
+			return 0;
+		}
+	}
+	//chi2 with ERR 1: the covariance is twice the inverse of its Hessian
+	Eigen::MatrixXd inverse = 2*solver.solve(Eigen::MatrixXd::Identity(nparam, nparam));
+	cov.resize(nparam*nparam);
+	for (int k = 0; k < nparam; ++k){
+		bstvl[k] = par[k];
+		error[k] = sqrt(inverse(k,k));
+		for (int l = 0; l < nparam; ++l) cov[k*nparam + l] = inverse(k,l);
+	}
+	chi2 = fitmodel.chi2(par.data());
+	return 1;
 }
 
 void HISTFITTER::savemetadata(TH1D *metadatahist, TString what, double value){
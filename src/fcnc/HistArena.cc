@@ -0,0 +1,50 @@
+#include "HistArena.h"
+#include <cstdio>
+#include <cstdlib>
+#include <sys/mman.h>
+
+HistArena::HistArena(long _pagesize, bool _shared) :
+pagesize(_pagesize), shared(_shared), used(0), nalloc(0), total(0)
+{
+}
+
+HistArena::~HistArena(){
+  clear();
+}
+
+double* HistArena::allocate(long n){
+  if(n <= 0) return 0;
+  if(pages.empty() || used + n > pagesize){
+    long newpage = n > pagesize ? n : pagesize;
+    double *page;
+    if(shared){
+      //anonymous mappings are zero filled
+      void *mapped = mmap(0, newpage*sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      page = mapped == MAP_FAILED ? 0 : (double*)mapped;
+    }else page = (double*)calloc(newpage, sizeof(double));
+    if(!page) {
+      printf("HistArena::allocate() ERROR: failed to allocate %ld doubles\n", newpage);
+      exit(0);
+    }
+    pages.push_back(page);
+    pagesizes.push_back(newpage);
+    used = 0;
+  }
+  double *ret = pages.back() + used;
+  used += n;
+  total += n;
+  nalloc++;
+  return ret;
+}
+
+void HistArena::clear(){
+  for (int i = 0; i < pages.size(); ++i){
+    if(shared) munmap(pages[i], pagesizes[i]*sizeof(double));
+    else free(pages[i]);
+  }
+  pages.clear();
+  pagesizes.clear();
+  used = 0;
+  nalloc = 0;
+  total = 0;
+}
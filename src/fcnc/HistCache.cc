@@ -0,0 +1,222 @@
+#include "HistCache.h"
+#include "TH1D.h"
+#include "TAxis.h"
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static const char cachemagic[8] = {'H','S','C','A','C','H','E','\0'};
+static const int cacheversion = 2;
+
+HistCache::HistCache() :
+data(0), size(0), header(0), samples(0), entries(0)
+{
+  memset(sourcestamp, 0, sizeof(sourcestamp));
+}
+
+HistCache::~HistCache(){
+  close();
+}
+
+bool HistCache::open(TString _filename){
+  close();
+  int fd = ::open(_filename.Data(), O_RDONLY);
+  if(fd < 0) return 0;
+  struct stat st;
+  if(fstat(fd, &st) || st.st_size < sizeof(cacheHeader)) {
+    ::close(fd);
+    return 0;
+  }
+  void *mapped = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(mapped == MAP_FAILED) return 0;
+  data = (char*)mapped;
+  size = st.st_size;
+  header = (const cacheHeader*)data;
+  if(memcmp(header->magic, cachemagic, 8) || header->version != cacheversion || header->size != size) {
+    printf("HistCache::open() WARNING: %s is not a valid histogram cache, ignored\n", _filename.Data());
+    close();
+    return 0;
+  }
+  filename = _filename;
+  samples = (const cacheSample*)(data + sizeof(cacheHeader));
+  entries = (const cacheEntry*)(samples + header->nsample);
+  index.reserve(header->nhist);
+  for (long i = 0; i < header->nhist; ++i) index[text(entries[i].name)] = i;
+  return 1;
+}
+
+void HistCache::close(){
+  if(data) munmap(data, size);
+  data = 0;
+  size = 0;
+  header = 0;
+  samples = 0;
+  entries = 0;
+  index.clear();
+}
+
+const cacheEntry* HistCache::find(TString name) const{
+  auto found = index.find(name.Data());
+  if(found == index.end()) return 0;
+  return entries + found->second;
+}
+
+TH1D* HistCache::hist(const cacheEntry &entry) const{
+  //default constructed: not added to gDirectory, safe to call from reader threads
+  TH1D *created = new TH1D();
+  created->SetName(text(entry.name));
+  created->SetTitle(text(entry.title));
+  if(entry.xbins) created->SetBins(entry.nbins, (const double*)(data + entry.xbins));
+  else created->SetBins(entry.nbins, entry.xlow, entry.xhigh);
+  created->Sumw2();
+  memcpy(created->GetArray(), sumw(entry), (entry.nbins+2)*sizeof(double));
+  memcpy(created->GetSumw2()->GetArray(), sumw2(entry), (entry.nbins+2)*sizeof(double));
+  created->ResetStats();
+  created->SetEntries(entry.entries);
+  created->SetFillColor(entry.fillcolor);
+  created->SetLineColor(entry.linecolor);
+  return created;
+}
+
+bool HistCache::stamp(TString sourcefile, long *sourcestamp){
+  struct stat sourcestat;
+  memset(sourcestamp, 0, 3*sizeof(long));
+  if(stat(sourcefile.Data(), &sourcestat)) return 0;
+  sourcestamp[0] = sourcestat.st_size;
+  sourcestamp[1] = sourcestat.st_mtim.tv_sec;
+  sourcestamp[2] = sourcestat.st_mtim.tv_nsec;
+  return 1;
+}
+
+bool HistCache::uptodate(TString cachefile, TString sourcefile){
+  //a timestamp comparison would miss a source rewritten within the clock resolution of the cache
+  long current[3];
+  if(!stamp(sourcefile, current)) return 0;
+  FILE *file = fopen(cachefile.Data(), "rb");
+  if(!file) return 0;
+  cacheHeader head;
+  bool ok = fread(&head, sizeof(cacheHeader), 1, file) == 1;
+  fclose(file);
+  return ok && !memcmp(head.magic, cachemagic, 8) && head.version == cacheversion && !memcmp(head.sourcestamp, current, sizeof(current));
+}
+
+unsigned long long HistCache::hash(const char *bytes, long n, unsigned long long seed){
+  for (long i = 0; i < n; ++i){
+    seed ^= (unsigned char)bytes[i];
+    seed *= 1099511628211ULL;
+  }
+  return seed;
+}
+
+unsigned long long HistCache::filehash(TString filename){
+  FILE *file = fopen(filename.Data(), "rb");
+  if(!file) return 0;
+  std::vector<char> buffer(1<<20);
+  unsigned long long ret = hash(0, 0);
+  for(size_t n; (n = fread(buffer.data(), 1, buffer.size(), file)) > 0;) ret = hash(buffer.data(), n, ret);
+  fclose(file);
+  return ret;
+}
+
+void HistCache::add_sample(TString name, TString title, int color){
+  pendingsamples.emplace_back(name.Data(), std::make_pair(std::string(title.Data()), color));
+}
+
+void HistCache::add(TString name, TH1 *hist, TString sample, TString region, TString variation, TString varname){
+  pending.emplace_back();
+  pendingEntry &added = pending.back();
+  added.name = name.Data();
+  added.sample = sample.Data();
+  added.region = region.Data();
+  added.variation = variation.Data();
+  added.varname = varname.Data();
+  added.title = hist->GetTitle();
+  memset(&added.entry, 0, sizeof(cacheEntry));
+  int nbins = hist->GetNbinsX();
+  added.entry.nbins = nbins;
+  added.entry.fillcolor = hist->GetFillColor();
+  added.entry.linecolor = hist->GetLineColor();
+  added.entry.xlow = hist->GetXaxis()->GetXmin();
+  added.entry.xhigh = hist->GetXaxis()->GetXmax();
+  added.entry.entries = hist->GetEntries();
+  added.bins.resize(2*(nbins+2));
+  for (int ib = 0; ib < nbins+2; ++ib){
+    added.bins[ib] = hist->GetBinContent(ib);
+    added.bins[nbins+2+ib] = hist->GetSumw2N() ? hist->GetSumw2()->At(ib) : fabs(added.bins[ib]);
+  }
+  const TArrayD *xbins = hist->GetXaxis()->GetXbins();
+  if(xbins->GetSize()) added.xbins.assign(xbins->GetArray(), xbins->GetArray() + xbins->GetSize());
+}
+
+bool HistCache::write(TString _filename){
+  std::vector<char> strings;
+  auto addstring = [&](const std::string &str){
+    long offset = strings.size();
+    strings.insert(strings.end(), str.c_str(), str.c_str() + str.size() + 1);
+    return offset;
+  };
+  cacheHeader head;
+  memset(&head, 0, sizeof(cacheHeader));
+  memcpy(head.magic, cachemagic, 8);
+  head.version = cacheversion;
+  head.nsample = pendingsamples.size();
+  head.nhist = pending.size();
+  memcpy(head.sourcestamp, sourcestamp, sizeof(sourcestamp));
+  long binoffset = sizeof(cacheHeader) + head.nsample*sizeof(cacheSample) + head.nhist*sizeof(cacheEntry);
+  long nbindoubles = 0;
+  for(auto &entry : pending) nbindoubles += entry.bins.size() + entry.xbins.size();
+  long stringoffset = binoffset + nbindoubles*sizeof(double);
+
+  std::vector<cacheSample> samplerecords(head.nsample);
+  for (int i = 0; i < head.nsample; ++i){
+    samplerecords[i].name = stringoffset + addstring(pendingsamples[i].first);
+    samplerecords[i].title = stringoffset + addstring(pendingsamples[i].second.first);
+    samplerecords[i].color = pendingsamples[i].second.second;
+    samplerecords[i].unused = 0;
+  }
+  std::vector<cacheEntry> records;
+  std::vector<double> bins;
+  bins.reserve(nbindoubles);
+  for(auto &entry : pending){
+    cacheEntry record = entry.entry;
+    record.name = stringoffset + addstring(entry.name);
+    record.sample = stringoffset + addstring(entry.sample);
+    record.region = stringoffset + addstring(entry.region);
+    record.variation = stringoffset + addstring(entry.variation);
+    record.varname = stringoffset + addstring(entry.varname);
+    record.title = stringoffset + addstring(entry.title);
+    record.sumw = binoffset + bins.size()*sizeof(double);
+    bins.insert(bins.end(), entry.bins.begin(), entry.bins.end());
+    record.xbins = entry.xbins.size() ? binoffset + bins.size()*sizeof(double) : 0;
+    bins.insert(bins.end(), entry.xbins.begin(), entry.xbins.end());
+    records.push_back(record);
+  }
+  head.size = stringoffset + strings.size();
+
+  //written under a temporary name and renamed, processes mapping the old cache keep a consistent file
+  TString tmpname = _filename + ".tmp";
+  FILE *file = fopen(tmpname.Data(), "wb");
+  if(!file) {
+    printf("HistCache::write() ERROR: cannot write %s\n", tmpname.Data());
+    return 0;
+  }
+  bool ok = fwrite(&head, sizeof(cacheHeader), 1, file) == 1;
+  if(head.nsample) ok = ok && fwrite(samplerecords.data(), sizeof(cacheSample), head.nsample, file) == head.nsample;
+  if(head.nhist) ok = ok && fwrite(records.data(), sizeof(cacheEntry), head.nhist, file) == head.nhist;
+  if(bins.size()) ok = ok && fwrite(bins.data(), sizeof(double), bins.size(), file) == bins.size();
+  if(strings.size()) ok = ok && fwrite(strings.data(), 1, strings.size(), file) == strings.size();
+  ok = !fclose(file) && ok;
+  if(!ok || rename(tmpname.Data(), _filename.Data())) {
+    printf("HistCache::write() ERROR: failed to write %s\n", _filename.Data());
+    remove(tmpname.Data());
+    return 0;
+  }
+  pendingsamples.clear();
+  pending.clear();
+  return 1;
+}
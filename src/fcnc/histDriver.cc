@@ -0,0 +1,202 @@
+#include "histDriver.h"
+#include "histSaver.h"
+#include "HistCache.h"
+#include "TSystem.h"
+#include <map>
+#include <deque>
+#include <chrono>
+#include <unistd.h>
+#include <sys/wait.h>
+using namespace std;
+
+//histSaver reports fatal errors with exit(0): in a child that has to count as a failure, and the atexit cleanup
+//of ROOT must not run on the files inherited from the parent
+static bool injob = 0;
+static void jobexit(){
+  if(injob) _exit(1);
+}
+
+histDriver::histDriver(function<histSaver*(TString)> _setup, function<void(histSaver*, TString)> _fill) :
+setup(_setup), fill(_fill), nworkers(0), nretry(2), sharedmemory(0), workdir("histdriver")
+{
+}
+
+TString histDriver::jobdir(TString stage, int ijob){
+  return workdir + "/" + stage + TString::Format("_%d", ijob);
+}
+
+void histDriver::removedir(TString dir){
+  void *dirp = gSystem->OpenDirectory(dir);
+  if(!dirp) return;
+  while(const char *entry = gSystem->GetDirEntry(dirp)){
+    TString name(entry);
+    if(name != "." && name != "..") gSystem->Unlink(dir + "/" + name);
+  }
+  gSystem->FreeDirectory(dirp);
+  gSystem->Unlink(dir);
+}
+
+vector<bool> histDriver::forkjobs(int njob, function<bool(int)> job, TString what, function<bool(int)> produced){
+  int nparallel = nworkers > 0 ? nworkers : sysconf(_SC_NPROCESSORS_ONLN);
+  if(nparallel < 1) nparallel = 1;
+  vector<bool> done(njob, 0);
+  vector<int> attempts(njob, 0);
+  deque<int> queue;
+  for (int ijob = 0; ijob < njob; ++ijob) queue.push_back(ijob);
+  map<pid_t, int> running;
+  int ndone = 0, nfailed = 0;
+  while(queue.size() || running.size()){
+    while(queue.size() && running.size() < nparallel){
+      int ijob = queue.front();
+      queue.pop_front();
+      attempts[ijob]++;
+      fflush(stdout);
+      fflush(stderr);
+      pid_t pid = fork();
+      if(pid < 0) {
+        printf("histDriver::forkjobs() ERROR: fork failed for %s job %d\n", what.Data(), ijob);
+        exit(0);
+      }
+      if(pid == 0){
+        injob = 1;
+        atexit(jobexit);
+        bool ok = 0;
+        try{
+          ok = job(ijob);
+        }catch(...){
+          ok = 0;
+        }
+        fflush(stdout);
+        fflush(stderr);
+        _exit(ok ? 0 : 1);
+      }
+      running[pid] = ijob;
+    }
+    int status;
+    pid_t pid = waitpid(-1, &status, 0);
+    if(pid < 0) break;
+    auto finished = running.find(pid);
+    if(finished == running.end()) continue;
+    int ijob = finished->second;
+    running.erase(finished);
+    bool ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if(ok && produced && !produced(ijob)) {
+      printf("histDriver::forkjobs() WARNING: %s job %d exited without its output\n", what.Data(), ijob);
+      ok = 0;
+    }
+    if(ok) {
+      done[ijob] = 1;
+      ndone++;
+    }else if(attempts[ijob] <= nretry){
+      printf("histDriver::forkjobs() WARNING: %s job %d failed (%s %d), retry %d/%d\n", what.Data(), ijob, WIFSIGNALED(status) ? "signal" : "exit code", WIFSIGNALED(status) ? WTERMSIG(status) : WEXITSTATUS(status), attempts[ijob], nretry);
+      queue.push_back(ijob);
+    }else{
+      printf("histDriver::forkjobs() ERROR: %s job %d failed %d times, given up\n", what.Data(), ijob, attempts[ijob]);
+      nfailed++;
+    }
+    printf("histDriver: %s %d/%d done, %d failed, %lu running\n", what.Data(), ndone, njob, nfailed, running.size());
+  }
+  return done;
+}
+
+histSaver* histDriver::run(vector<TString> inputs, TString outputfilename){
+  auto start = chrono::steady_clock::now();
+  gSystem->mkdir(workdir, 1);
+  failed.clear();
+  if(sharedmemory){
+    histSaver *saver = setup(outputfilename);
+    saver->share_bins();
+    int retry = nretry;
+    nretry = 0;
+    vector<bool> filled = forkjobs(inputs.size(), [&](int ijob){
+      fill(saver, inputs[ijob]);
+      return true;
+    }, "fill");
+    nretry = retry;
+    for (int ijob = 0; ijob < inputs.size(); ++ijob) if(!filled[ijob]) failed.push_back(inputs[ijob]);
+    saver->sync_slots();
+    printf("histDriver::run() : %lu inputs filled in shared memory, %lu failed, %4.2f s\n", inputs.size()-failed.size(), failed.size(), chrono::duration<double>(chrono::steady_clock::now() - start).count());
+    for(auto const& input : failed) printf("histDriver::run() : failed input %s, not retried, its partial fill is kept\n", input.Data());
+    return saver;
+  }
+  auto partialname = [&](TString stage, int ijob){ return jobdir(stage, ijob) + ".hcache"; };
+  //each child fills one input into a private histSaver and writes it out, the output files it opens are scratch
+  auto cachejob = [&](TString stage, int ijob, function<bool(histSaver*)> body){
+    gSystem->mkdir(jobdir(stage, ijob), 1);
+    histSaver *saver = setup(jobdir(stage, ijob) + "/hist");
+    bool ok = body(saver);
+    if(ok) saver->dump_cache(partialname(stage, ijob));
+    delete saver;
+    return ok && !gSystem->AccessPathName(partialname(stage, ijob));
+  };
+
+  vector<bool> filled = forkjobs(inputs.size(), [&](int ijob){
+    return cachejob("fill", ijob, [&](histSaver *saver){
+      fill(saver, inputs[ijob]);
+      return true;
+    });
+  }, "fill", [&](int ijob){ return !gSystem->AccessPathName(partialname("fill", ijob)); });
+  //the inputs summed in each partial, to report them when a merge fails
+  vector<TString> partials;
+  vector<vector<TString>> contents;
+  for (int ijob = 0; ijob < inputs.size(); ++ijob){
+    removedir(jobdir("fill", ijob));
+    if(filled[ijob]) {
+      partials.push_back(partialname("fill", ijob));
+      contents.push_back({inputs[ijob]});
+    }
+    else failed.push_back(inputs[ijob]);
+  }
+
+  //tree reduction: pairs of partials are merged in parallel until one is left
+  for (int level = 0; partials.size() > 1; ++level){
+    TString stage = TString::Format("merge%d", level);
+    int npair = partials.size()/2;
+    vector<bool> merged = forkjobs(npair, [&](int ijob){
+      return cachejob(stage, ijob, [&](histSaver *saver){
+        HistCache second;
+        if(!saver->load_cache(partials[2*ijob]) || !second.open(partials[2*ijob+1])) return false;
+        saver->merge_cache(second, 1);
+        return true;
+      });
+    }, stage, [&](int ijob){ return !gSystem->AccessPathName(partialname(stage, ijob)); });
+    vector<TString> next;
+    vector<vector<TString>> nextcontents;
+    for (int ijob = 0; ijob < npair; ++ijob){
+      removedir(jobdir(stage, ijob));
+      gSystem->Unlink(partials[2*ijob]);
+      gSystem->Unlink(partials[2*ijob+1]);
+      if(!merged[ijob]) {
+        printf("histDriver::run() ERROR: merging %s and %s failed, their %lu inputs are dropped\n", partials[2*ijob].Data(), partials[2*ijob+1].Data(), contents[2*ijob].size()+contents[2*ijob+1].size());
+        for(int i = 2*ijob; i < 2*ijob+2; i++) failed.insert(failed.end(), contents[i].begin(), contents[i].end());
+        continue;
+      }
+      next.push_back(partialname(stage, ijob));
+      nextcontents.push_back(contents[2*ijob]);
+      nextcontents.back().insert(nextcontents.back().end(), contents[2*ijob+1].begin(), contents[2*ijob+1].end());
+    }
+    if(partials.size()%2) {
+      next.push_back(partials.back());
+      nextcontents.push_back(contents.back());
+    }
+    partials = next;
+    contents = nextcontents;
+  }
+
+  histSaver *saver = setup(outputfilename);
+  if(partials.size()) {
+    if(!saver->load_cache(partials[0])) {
+      printf("histDriver::run() ERROR: loading %s failed, its %lu inputs are dropped\n", partials[0].Data(), contents[0].size());
+      failed.insert(failed.end(), contents[0].begin(), contents[0].end());
+    }
+    gSystem->Unlink(partials[0]);
+    //the output files are opened by the fill methods, which did not run in this process
+    for(auto& sample : saver->plot_lib)
+      for(auto& region : sample.second)
+        for(auto& variation : region.second)
+          if(saver->outputfile.find(variation.first) == saver->outputfile.end()) saver->openoutput(variation.first);
+  }
+  printf("histDriver::run() : %lu inputs filled, %lu failed, %d workers, %4.2f s\n", inputs.size()-failed.size(), failed.size(), nworkers > 0 ? nworkers : (int)sysconf(_SC_NPROCESSORS_ONLN), chrono::duration<double>(chrono::steady_clock::now() - start).count());
+  for(auto const& input : failed) printf("histDriver::run() : failed input %s\n", input.Data());
+  return saver;
+}
@@ -2,10 +2,23 @@
 #include "fcnc_include.h"
 #include "TGaxis.h"
 #include "TGraph.h"
+#include "TKey.h"
+#include "HistCache.h"
+#include "BackgroundWriter.h"
 #include "AtlasStyle.h"
 #include "AtlasLabels.h"
 #include "HISTFITTER.h"
 #include "LatexChart.h"
+#include "fillkernel.h"
+#include "region.h"
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <set>
+#include <cstring>
+#include <fstream>
+#include <sys/stat.h>
 
 using namespace std;
 histSaver::histSaver(TString _outputfilename) {
@@ -26,10 +39,21 @@ histSaver::histSaver(TString _outputfilename) {
   workflow = "work in progress";
   debug = 1;
   sensitivevariable = "";
+  usearena = 0;
+  sharedbins = 0;
+  compressionsettings = -1;
+  usecache = 0;
+  lazyread = 0;
+  linearfit = 0;
+  partialdir = "partials";
+  arena = 0;
+  writer = 0;
+  nregionindexed = 0;
 }
 
 histSaver::~histSaver() {
   if(debug) printf("histSaver::~histSaver()\n");
+  deletepointer(writer); //finishes the queued writes first
   for(auto& samp : plot_lib){
     for(auto &reg: samp.second) {
       for(auto &variation: reg.second) {
@@ -42,6 +66,8 @@ histSaver::~histSaver() {
     }
   }
   if(debug) std::cout<<"plot_lib destructed"<<std::endl;
+  deletepointer(arena);
+  for(auto &index : keyindex) deletepointer(index.second.cache);
   deletepointer(inputfile);
   if(debug) std::cout<<"inputfile destructed"<<std::endl;
   for(auto &file : outputfile)
@@ -53,12 +79,17 @@ histSaver::~histSaver() {
 void histSaver::printyield(TString region){
   printf("Print Yeild: %s\n", region.Data());
   double er;
+  int ivar = yieldvar(region);
+  if(ivar < 0) {
+    printf("Warning: no variable active in region %s\n", region.Data());
+    return;
+  }
   for(auto iter: plot_lib){
-    TH1D* target = grabhist_int(iter.first,region,0,0);
+    TH1D* target = grabhist_int(iter.first,region,ivar,0);
     if(target){
       printf("%s: %4.3f \\pm %4.3f\n", iter.first.Data(), target->IntegralAndError(1,target->GetNbinsX(), er), er);
     }else{
-      printf("Warning: histogram not found: %s, %s, %s\n", iter.first.Data(), region.Data(), v[0]->name.Data());
+      printf("Warning: histogram not found: %s, %s, %s\n", iter.first.Data(), region.Data(), v[ivar]->name.Data());
     }
   }
 }
@@ -71,6 +102,8 @@ observable histSaver::calculateYield(TString region, string formula, TString var
   if(tokens.size()%2) printf("Error: Wrong formula format: %s\nShould be like: 1 data -1 real -1 zll ...", formula.c_str());
   vector<TH1D*> newvec;
   observable scaleto(0,0);
+  int ivar = yieldvar(region);
+  if(ivar < 0) return yield;
 
   for (int i = 0; i < tokens.size()/2; ++i)
   {
@@ -84,7 +117,7 @@ observable histSaver::calculateYield(TString region, string formula, TString var
       exit(1);
     }
     TString sample=tokens[icompon+1].c_str();
-    TH1D *target=grabhist(sample,region, sample == "data" ? "NOMINAL" : variation,0);
+    TH1D *target=grabhist(sample,region, sample == "data" ? "NOMINAL" : variation,ivar);
     if(target){
       double err;
       observable thisyield(integral(target,1,target->GetNbinsX()));
@@ -95,34 +128,78 @@ observable histSaver::calculateYield(TString region, string formula, TString var
 }
 
 int histSaver::findvar(TString varname){
-  for (int i = 0; i < v.size(); ++i)
-  {
-    if(v.at(i)->name == varname) return i;
-  }
+  int ivar = varid(varname);
+  if(ivar >= 0) return ivar;
   printf("varname not found: %s\n", varname.Data());
   exit(0);
 }
 
+int histSaver::varid(TString varname){
+  if(varindex.size() != v.size()){
+    varindex.clear();
+    for (int i = v.size()-1; i >= 0; --i) varindex[v.at(i)->name.Data()] = i; //the first of duplicated names
+  }
+  auto found = varindex.find(varname.Data());
+  return found == varindex.end() ? -1 : found->second;
+}
+
 TH1D* histSaver::grabhist_int(TString sample, TString region, int ivar, bool vital){
   return grabhist(sample, region, "NOMINAL", ivar, vital);
 }
 
 TH1D* histSaver::grabhist(TString sample, TString region, TString variation, TString varname, bool vital){
-  int ivar = -1;
-  for (int i = 0; i < v.size(); ++i)
-  {
-    if(varname == v.at(i)->name){
-      ivar = i;
-      break;
-    }
+  return grabhist(sample, region, variation, varid(varname), vital);
+}
+
+pair<vector<TH1D*>*, int>* histSaver::histentry(int isample, int iregion, int ivariation){
+  unsigned long long key = histkey(isample, iregion, ivariation);
+  auto found = histindex.find(key);
+  if(found != histindex.end()) return &found->second;
+  if(isample < 0 || isample >= sampleids.names.size() || iregion < 0 || iregion >= regions.size() || ivariation < 0 || ivariation >= variationids.names.size()) return 0;
+  //plot_lib entries are never erased, the vector stays at the same address. Misses are not remembered, the entry may come later
+  auto samp = plot_lib.find(sampleids.names[isample]);
+  if(samp == plot_lib.end()) return 0;
+  auto reg = samp->second.find(regions[iregion]);
+  if(reg == samp->second.end()) return 0;
+  auto vari = reg->second.find(variationids.names[ivariation]);
+  if(vari == reg->second.end()) return 0;
+  int islot = slots.size() ? findslot(samp->first, reg->first, vari->first) : -1;
+  return &histindex.insert(make_pair(key, make_pair(&vari->second, islot))).first->second;
+}
+
+TH1D* histSaver::grabhist(int isample, int iregion, int ivariation, int ivar, bool vital){
+  auto entry = histentry(isample, iregion, ivariation);
+  if(!entry) {
+    if(debug) printf("histSaver:grabhist  Warning: sample id %d region id %d variation id %d not found\n", isample, iregion, ivariation);
+    if(debug) show();
+    if(vital) exit(0);
+    return 0;
   }
-  return grabhist(sample, region, variation, ivar, vital);
+  if(entry->second >= 0 && ivar >= 0) sync_slot(entry->second, ivar);
+  if(lazy_lib.size()) loadlazy(sampleids.names[isample], regions[iregion], variationids.names[ivariation], ivar);
+  return bookedhist(*entry->first, sampleids.names[isample], regions[iregion], variationids.names[ivariation], ivar);
+}
+
+vector<TH1D*>* histSaver::grabhists(int isample, int iregion, int ivariation){
+  auto entry = histentry(isample, iregion, ivariation);
+  return entry ? entry->first : 0;
 }
 
 TH1D* histSaver::grabhist(TString sample, TString region, TString variation, int ivar, bool vital){
   if(sample == "data"&& !variation.Contains("FFNP_")){
      variation = "NOMINAL";
   } 
+  //names are only looked up here, a miss adds nothing to the name tables
+  int iregion = findregion(region), isample = sampleids.find(sample), ivariation = variationids.find(variation);
+  if(iregion >= 0 && isample >= 0 && ivariation >= 0) {
+    auto entry = histentry(isample, iregion, ivariation);
+    if(entry) {
+      if(entry->second >= 0 && ivar >= 0) sync_slot(entry->second, ivar);
+      if(lazy_lib.size()) loadlazy(sample, region, variation, ivar);
+      return bookedhist(*entry->first, sample, region, variation, ivar);
+    }
+  }
+  //not indexed: reports which part is missing
   auto samp = plot_lib.find(sample);
   if(samp == plot_lib.end()) {
     if(debug) printf("histSaver:grabhist  Warning: sample %s not found\n", sample.Data());
@@ -144,18 +221,39 @@ TH1D* histSaver::grabhist(TString sample, TString region, TString variation, int
     if(vital) exit(0);
     return 0;
   }
-  return vari->second.at(ivar);
+  //the entry exists: its names get ids, the next grabs go through the index
+  if(iregion >= 0) histentry(sampleids.intern(sample), iregion, variationids.intern(variation));
+  if(slots.size()){
+    int islot = findslot(sample, region, variation);
+    if(islot >= 0 && ivar >= 0) sync_slot(islot, ivar);
+  }
+  if(lazy_lib.size()) loadlazy(sample, region, variation, ivar);
+  return bookedhist(vari->second, sample, region, variation, ivar);
+}
+
+TH1D* histSaver::bookedhist(vector<TH1D*> &hists, TString sample, TString region, TString variation, int ivar){
+  if(ivar < 0) return 0;
+  TH1D *&hist = hists.at(ivar);
+  if(!hist && fillbooked.count(&hists) && isactive(region, ivar) && !iscompleted(sample, variation)) hist = newhist(sample, region, variation, ivar);
+  return hist;
+}
+
+vector<TH1D*>* histSaver::grabhists(TString sample, TString region, TString variation){
+  if(sample == "data"&& !variation.Contains("FFNP_")) variation = "NOMINAL";
+  int iregion = findregion(region), isample = sampleids.find(sample), ivariation = variationids.find(variation);
+  if(iregion >= 0 && isample >= 0 && ivariation >= 0) return grabhists(isample, iregion, ivariation);
+  auto samp = plot_lib.find(sample);
+  if(samp == plot_lib.end()) return 0;
+  auto reg = samp->second.find(region);
+  if(reg == samp->second.end()) return 0;
+  auto vari = reg->second.find(variation);
+  if(vari == reg->second.end()) return 0;
+  if(iregion >= 0) histentry(sampleids.intern(sample), iregion, variationids.intern(variation));
+  return &vari->second;
 }
 
 TH1D* histSaver::grabhist(TString sample, TString region, TString varname, bool vital){
-  int ivar = -1;
-  for (int i = 0; i < v.size(); ++i)
-  {
-    if(varname == v.at(i)->name){
-      ivar = i;
-      break;
-    }
-  }
+  int ivar = varid(varname);
   return grabhist(sample, region, ivar, vital);
 }
 
@@ -186,16 +284,32 @@ TH1D* histSaver::grabdatahist(TString region, int ivar){
   return grabhist("data",region,ivar);
 }
 
+Float_t readExpression(const varBinding &binding){
+  return binding.expression();
+}
+
+void histSaver::add(variable* v_, function<double()> expression){
+  add(v_);
+  bind(v.size()-1, expression);
+}
+
+void histSaver::bind(int ivar, function<double()> expression){
+  bindings.at(ivar).expression = expression;
+  bindings.at(ivar).read = &readExpression;
+  bindings.at(ivar).type = "expression";
+}
+
+Float_t readUnbound(const varBinding &binding){
+  printf("error: fill variable failed. no type available for var %s\n", binding.var ? binding.var->name.Data() : "");
+  exit(0);
+}
+
 Float_t histSaver::getVal(Int_t i) {
-  Float_t tmp = -999999;
-  if(address1[i])      { if(debug) printf("fill address1\n"); tmp = *address1[i]*v.at(i)->scale; }
-  else if(address3[i]) { if(debug) printf("fill address3\n"); tmp = *address3[i]*v.at(i)->scale; }
-  else if(address2[i]) { if(debug) printf("fill address2\n"); tmp = *address2[i]; }
-  else {
-    printf("error: fill variable failed. no type available for var %s\n",v.at(i)->name.Data());
-    exit(0);
-  }
-  if(debug == 1) printf("fill value: %4.2f\n", tmp);
+  const varBinding &binding = bindings[i];
+  return clampVal(i, binding.read(binding));
+}
+
+Float_t histSaver::clampVal(Int_t i, Float_t tmp) {
   if (!v.at(i)->xbins){
     if(tmp >= v.at(i)->xhigh) tmp = v.at(i)->xhigh*0.999999;
     if(tmp < v.at(i)->xlow) tmp = v.at(i)->xlow;
@@ -215,12 +329,10 @@ void histSaver::show(){
   for(auto const& region: regions) {
     printf("histSaver::show()\tregion: %s\n", region.Data());
   }
-  if(address1.size() == v.size()) {
+  if(bindings.size() == v.size()) {
     for (int i = 0; i < v.size(); ++i)
     {
-      if(address2[i]) printf("histSaver::show()\t%s = %d\n", v.at(i)->name.Data(), *address2[i]);
-      else if(address1[i]) printf("histSaver::show()\t%s = %4.2f\n", v.at(i)->name.Data(), *address1[i]*v.at(i)->scale);
-      else if(address3[i]) printf("histSaver::show()\t%s = %4.2f\n", v.at(i)->name.Data(), *address3[i]*v.at(i)->scale);
+      if(bindings[i].read != &readUnbound) printf("histSaver::show()\t%s = %4.2f\n", v.at(i)->name.Data(), bindings[i].read(bindings[i]));
     }
   }
 }
@@ -258,6 +370,7 @@ void histSaver::merge_regions(vector<TString> inputregions, TString outputregion
       {
         auto &tmpiter = iter.second[outputregion][variation.first];
         tmpiter.push_back(0);
+        if(!isactive(outputregion, i)) continue;
         for(auto region:existregions){
           TH1D* addtarget = grabhist(iter.first,region,variation.first,i);
           if(addtarget){
@@ -301,9 +414,13 @@ void histSaver::merge_regions(TString inputregion1, TString inputregion2, TStrin
     for(auto &variation : iter.second[inputregion1])
     for (int i = 0; i < v.size(); ++i)
     {
+      auto &tmpiter = iter.second[outputregion][variation.first];
+      if(!isactive(outputregion, i)) {
+        tmpiter.push_back(0);
+        continue;
+      }
       TH1D* addtarget1 = grabhist(iter.first,inputregion1,variation.first,i);
       TH1D* addtarget2 = grabhist(iter.first,inputregion2,variation.first,i);
-      auto &tmpiter = iter.second[outputregion][variation.first];
       if(input1exist == 1 && addtarget1) tmpiter.push_back((TH1D*)addtarget1->Clone(iter.first + "_" + variation.first+"_"+outputregion+"_"+v.at(i)->name + "_buffer"));
       else if(addtarget2) tmpiter.push_back((TH1D*)addtarget2->Clone(iter.first + "_" + variation.first+"_"+outputregion+"_"+v.at(i)->name + +"_buffer"));
       else tmpiter.push_back(0);
@@ -323,9 +440,8 @@ void histSaver::add_sample(TString samplename, TString sampletitle, enum EColor
 }
 void histSaver::init_hist(map<TString,map<TString,map<TString,vector<TH1D*>>>>::iterator sample_lib, TString region, TString variation){
   createdNP = variation;
-  if(outputfile.find(variation) == outputfile.end()) outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root","update");
+  if(outputfile.find(variation) == outputfile.end()) openoutput(variation);
   else outputfile[variation]->cd();
-  auto sampleiter = find_if(samples.begin(),samples.end(),[sample_lib](fcncSample const& tmp){return sample_lib->first == tmp.name;});
   if(debug) {
     printf("histSaver::init_hist() : add new sample: %s\n", sample_lib->first);
     printf("histSaver::init_hist() : variation: %s\n",variation.Data());
@@ -335,22 +451,9 @@ void histSaver::init_hist(map<TString,map<TString,map<TString,vector<TH1D*>>>>::
   regionpair.first = region;
   auto regioniter = sample_lib->second.insert(regionpair).first;
   regionpair.first = region;
-  for (int i = 0; i < v.size(); ++i){
-    if(debug) printf("histSaver::init_hist(): var %s\n",v.at(i)->name.Data());
-    TString histname = sample_lib->first + "_" + variation  + "_" +  region + "_" + v.at(i)->name + "_buffer";
-    TH1D *created = new TH1D(histname,sampleiter->title,v.at(i)->nbins,v.at(i)->xlow,v.at(i)->xhigh);
-    created->SetDirectory(0);
-    regioniter->second[variation].push_back(created);
-    created->Sumw2();
-    if (sample_lib->first != "data")
-    {
-      //created->Sumw2();
-      created->SetFillColor(sampleiter->color);
-      created->SetLineWidth(1);
-      created->SetLineColor(kBlack);
-      created->SetMarkerSize(0);
-    }
-  }
+  //the histograms are created on the first fill, see fill_hist() and slotbins()
+  regioniter->second[variation].resize(v.size(),0);
+  fillbooked.insert(&regioniter->second[variation]);
   
   if(debug == 1) printf("plot_lib[%s][%s][%s]\n", sample_lib->first.Data(), region.Data(), variation.Data());
   
@@ -359,6 +462,23 @@ void histSaver::init_hist(map<TString,map<TString,map<TString,vector<TH1D*>>>>::
   if(debug) printf("finished initializing %s\n", sample_lib->first.Data() );
 }
 
+TH1D* histSaver::newhist(TString sample, TString region, TString variation, int ivar){
+  auto sampleiter = find_if(samples.begin(),samples.end(),[sample](fcncSample const& tmp){return sample == tmp.name;});
+  TString histname = sample + "_" + variation  + "_" +  region + "_" + v.at(ivar)->name + "_buffer";
+  TH1D *created = new TH1D(histname,sampleiter == samples.end() ? sample : sampleiter->title,v.at(ivar)->nbins,v.at(ivar)->xlow,v.at(ivar)->xhigh);
+  created->SetDirectory(0);
+  created->Sumw2();
+  if (sample != "data" && sampleiter != samples.end())
+  {
+    //created->Sumw2();
+    created->SetFillColor(sampleiter->color);
+    created->SetLineWidth(1);
+    created->SetLineColor(kBlack);
+    created->SetMarkerSize(0);
+  }
+  return created;
+}
+
 vector<observable> histSaver::scale_to_data(TString scaleregion, string formula, TString scaleVariable, vector<double> slices, TString variation){
   int nslice = slices.size();
   int ivar = 0;
@@ -376,7 +496,7 @@ vector<observable> histSaver::scale_to_data(TString scaleregion, string formula,
     }
   }
 
-  if(outputfile.find(variation) == outputfile.end()) outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root", "update");
+  if(outputfile.find(variation) == outputfile.end()) openoutput(variation);
   else outputfile[variation]->cd();
   vector<TString> tokens = split(formula.c_str()," ");
   if(tokens.size()%2) printf("Error: Wrong formula format: %s\nShould be like: 1 real 1 zll ...", formula.c_str());
@@ -487,99 +607,141 @@ map<TString,vector<observable>>* histSaver::fit_scale_factor(vector<TString> *fi
 }
 
 map<TString,vector<observable>>* histSaver::fit_scale_factor(vector<TString> *fit_regions, TString *variable, map<TString,map<TString,vector<TString>>> *scalesamples, const vector<double> *slices, TString *_variation, map<TString,map<TString,vector<TString>>> *postfit_regions){
-  if(!postfit_regions) postfit_regions = scalesamples;
-  auto *scalefactors = new map<TString,vector<observable>>();
   TString variation = _variation? *_variation:"NOMINAL";
-  vector<observable> iter;
-  int nbins = v[findvar(*variable)]->nbins;
-  int ihists = 0;
-  vector<int> binslices;
-  HISTFITTER* fitter = new HISTFITTER();
+  auto fitted = fit_scale_factors(fit_regions, variable, scalesamples, slices, {variation}, 1, postfit_regions);
+  auto found = fitted.find(variation);
+  if(found == fitted.end()) {
+    printf("histSaver::fit_scale_factor() ERROR: variation %s not fitted, no scale factors\n", variation.Data());
+    return 0;
+  }
+  return new map<TString,vector<observable>>(found->second);
+}
+
+map<TString,map<TString,vector<observable>>> histSaver::fit_scale_factors(vector<TString> *fit_regions, TString *variable, map<TString,map<TString,vector<TString>>> *scalesamples, const vector<double> *slices, vector<TString> variations, int nthreads, map<TString,map<TString,vector<TString>>> *postfit_regions){
+  if(!postfit_regions) postfit_regions = scalesamples;
+  auto start = chrono::steady_clock::now();
+  map<TString,map<TString,vector<observable>>> scalefactors; //scalefactors[variation][param][islice]
+  int nslice = slices->size()-1;
   vector<TString> params;
   for(auto sample : *scalesamples) {
     if(sample.second.size()){
       for(auto sfForReg : sample.second){
-        fitter->setparam("sf_" + sample.first + "_" + sfForReg.first, 1, 0.1, 0.,2.);
         printf("fit region: ");
         for(auto regions : sfForReg.second) printf(" %s ", regions.Data());
         printf("\n");
         params.push_back("sf_" + sample.first + "_" + sfForReg.first);
       }
     }else{
-      fitter->setparam("sf_" + sample.first, 1, 0.1, 0.,2.);
       printf("fit region: All\n");
       params.push_back("sf_" + sample.first);
     }
   }
-  for (int i = 0; i < slices->size()-1; ++i)
+  //gather: one fitter per (variation, slice), the histograms are read here
+  vector<HISTFITTER*> fitters(variations.size()*nslice, 0);
+  map<TString, vector<int>> binslices;
+  set<TString> skipped; //no data or no component to fit, HISTFITTER would stop on a worker thread
+  for (int ivariation = 0; ivariation < variations.size(); ++ivariation)
   {
+    TString variation = variations[ivariation];
     auto fitsamples = stackorder;
     fitsamples.push_back("data");
-    for(auto sample : fitsamples){
-      for(auto reg : *fit_regions){
-        TH1D *target = grabhist(sample,reg,variation,*variable);
-        if(!target) continue;
-        if(ihists == 0) {
-          binslices = resolveslices(target,slices);
-        }
-        bool scale = 0;
-        TString SFname = "";
-        TString addsample = sample;
-        for(auto ssample : *scalesamples) {
-          if(ssample.first == sample) {
-            if(ssample.second.size()){
-              for(auto sfForReg: ssample.second){
-                for(auto sfreg: sfForReg.second){
-                  if (sfreg == reg)
-                  {
-                    addsample = sample + "_" + sfForReg.first;
+    bool hasdata = 0, hascomponent = 0;
+    for (int i = 0; i < nslice; ++i)
+    {
+      HISTFITTER* fitter = new HISTFITTER();
+      fitter->debug = debug && ivariation == 0 && i == 0;
+      fitter->linearsolve = linearfit;
+      for(auto par : params) fitter->setparam(par, 1, 0.1, 0.,2.);
+      for(auto sample : fitsamples){
+        for(auto reg : *fit_regions){
+          TH1D *target = grabhist(sample,reg,variation,*variable);
+          if(!target) continue;
+          if(sample == "data") hasdata = 1;
+          else hascomponent = 1;
+          if(!binslices[variation].size()) binslices[variation] = resolveslices(target,slices);
+          TString SFname = "";
+          TString addsample = sample;
+          for(auto ssample : *scalesamples) {
+            if(ssample.first == sample) {
+              if(ssample.second.size()){
+                for(auto sfForReg: ssample.second){
+                  for(auto sfreg: sfForReg.second){
+                    if (sfreg == reg)
+                    {
+                      addsample = sample + "_" + sfForReg.first;
+                    }
                   }
                 }
               }
+              SFname = "sf_" + addsample;
             }
-            SFname = "sf_" + addsample;
           }
+          fitter->addfithist(sample,target,binslices[variation][i],binslices[variation][i+1]-1,SFname);
         }
-        fitter->addfithist(sample,target,binslices[i],binslices[i+1]-1,SFname);
-        ihists++;
       }
+      fitters[ivariation*nslice + i] = fitter;
     }
-    Double_t val[10],err[10];
-    //fitter->debug();
-//============================ do fit here============================
-    //fitter->asimovfit(100,nprong[iprong]+"ptbin"+char(ptbin+'0')+".root");
-    double chi2 = fitter->fit(val,err,0);
-    int ipar = 0;
-    for (auto par: params)
-    {
-      (*scalefactors)[par].push_back(observable(val[ipar],err[ipar]));
-      ipar++;
-    }
-    fitter->clear();
-  }
-  for(auto samp : *postfit_regions){
-    TH1D *target;
-    map<TString,vector<TString>> plotregions;
-    if(samp.second.size() == 0){
-      plotregions["sf_" + samp.first] = *fit_regions;
-    }else if(samp.second.size() == 1){
-      for(auto sfForReg : samp.second)
-        plotregions["sf_" + samp.first] = sfForReg.second;
-    }else{
-      for(auto sfForReg : samp.second)
-        plotregions["sf_" + samp.first + "_" + sfForReg.first] = sfForReg.second;
+    if(!hasdata || !hascomponent) {
+      printf("histSaver::fit_scale_factor() WARNING: variation %s has no %s histogram of %s in the fit regions, not fitted\n", variation.Data(), hasdata ? "background" : "data", variable->Data());
+      skipped.insert(variation);
+      for (int i = 0; i < nslice; ++i) deletepointer(fitters[ivariation*nslice + i]);
     }
+  }
+//============================ do fit here============================
+  //fit: the fitters share nothing, any number of them run at the same time
+  vector<vector<double>> val(fitters.size(), vector<double>(params.size())), err = val;
+  if(nthreads <= 0) nthreads = thread::hardware_concurrency();
+  if(nthreads > fitters.size()) nthreads = fitters.size();
+  if(nthreads <= 1) {
+    for (int ifit = 0; ifit < fitters.size(); ++ifit) if(fitters[ifit]) fitters[ifit]->fit(val[ifit].data(),err[ifit].data(),0);
+  }else{
+    ROOT::EnableThreadSafety();
+    atomic<int> nextfit(0);
+    vector<thread> workers;
+    for (int ithread = 0; ithread < nthreads; ++ithread)
+      workers.emplace_back([&](){
+        for(int ifit = nextfit++; ifit < fitters.size(); ifit = nextfit++) if(fitters[ifit]) fitters[ifit]->fit(val[ifit].data(),err[ifit].data(),0);
+      });
+    for(auto &worker : workers) worker.join();
+  }
+  int nlinear = 0, nfitted = 0;
+  for (int ifit = 0; ifit < fitters.size(); ++ifit){
+    if(!fitters[ifit]) continue;
+    nfitted++;
+    for (int ipar = 0; ipar < params.size(); ++ipar) scalefactors[variations[ifit/nslice]][params[ipar]].push_back(observable(val[ifit][ipar],err[ifit][ipar]));
+    nlinear += fitters[ifit]->nlinear;
+    deletepointer(fitters[ifit]);
+  }
+  if(linearfit) printf("histSaver::fit_scale_factor() : %d slices solved linearly, %d with Minuit\n", nlinear, nfitted-nlinear);
+
+  //apply: scale the post-fit regions of every variation
+  for(auto variation : variations){
+    if(skipped.count(variation)) continue;
+    auto &fitted = scalefactors[variation];
+    for(auto samp : *postfit_regions){
+      TH1D *target;
+      map<TString,vector<TString>> plotregions;
+      if(samp.second.size() == 0){
+        plotregions["sf_" + samp.first] = *fit_regions;
+      }else if(samp.second.size() == 1){
+        for(auto sfForReg : samp.second)
+          plotregions["sf_" + samp.first] = sfForReg.second;
+      }else{
+        for(auto sfForReg : samp.second)
+          plotregions["sf_" + samp.first + "_" + sfForReg.first] = sfForReg.second;
+      }
 
-    for(auto sf : plotregions){
-      for(auto reg : sf.second){
-        target = grabhist(samp.first,reg,variation,*variable);
-        if(!target) continue;
-        for (int islice = 0; islice < slices->size()-1; ++islice)
-        {
-          for (int i = binslices[islice]; i < binslices[islice+1]; ++i)
+      for(auto sf : plotregions){
+        for(auto reg : sf.second){
+          target = grabhist(samp.first,reg,variation,*variable);
+          if(!target) continue;
+          for (int islice = 0; islice < nslice; ++islice)
           {
-            target->SetBinContent(i,target->GetBinContent(i) * (*scalefactors)[sf.first][islice].nominal);
-            target->SetBinError(i,target->GetBinError(i) * (*scalefactors)[sf.first][islice].nominal);
+            for (int i = binslices[variation][islice]; i < binslices[variation][islice+1]; ++i)
+            {
+              target->SetBinContent(i,target->GetBinContent(i) * fitted[sf.first][islice].nominal);
+              target->SetBinError(i,target->GetBinError(i) * fitted[sf.first][islice].nominal);
+            }
           }
         }
       }
@@ -595,14 +757,20 @@ map<TString,vector<observable>>* histSaver::fit_scale_factor(vector<TString> *fi
     printf(" %s ", param.Data());
   }
   printf("\n");
-  for (int i = 0; i < slices->size()-1; ++i){
-    printf("(%4.2f, %4.2f): ",(*slices)[i], (*slices)[i+1]);
-    for(auto par: params){
-      printf("%4.2f +/- %4.2f, ", (*scalefactors)[par][i].nominal, (*scalefactors)[par][i].error);
+  for(auto variation : variations){
+    auto fitted = scalefactors.find(variation);
+    if(skipped.count(variation) || fitted == scalefactors.end()) continue;
+    if(variations.size() > 1) printf("variation %s:\n", variation.Data());
+    for (int i = 0; i < nslice; ++i){
+      printf("(%4.2f, %4.2f): ",(*slices)[i], (*slices)[i+1]);
+      for(auto par: params){
+        const observable &sf = fitted->second.at(par)[i];
+        printf("%4.2f +/- %4.2f, ", sf.nominal, sf.error);
+      }
+      printf("\n");
     }
-    printf("\n");
   }
-
+  if(variations.size() > 1) printf("histSaver::fit_scale_factors() : %lu fits with %d threads in %4.2f s\n", fitters.size(), max(nthreads,1), chrono::duration<double>(chrono::steady_clock::now() - start).count());
   return scalefactors;
 }
 
@@ -644,86 +812,414 @@ vector<int> histSaver::resolveslices(TH1D* target, const vector<double> *slices)
   return ret;
 }
 
-void histSaver::read_sample(TString samplename, TString savehistname, TString variation, TString sampleTitle, enum EColor color, double norm, TFile *_inputfile, bool applyVariation){
+sampleRead::sampleRead(TString _samplename, TString _savehistname, TString _variation, TString _sampleTitle, enum EColor _color, double _norm, TFile *_inputfile, bool _applyVariation):
+samplename(_samplename), savehistname(_savehistname), variation(_variation), sampleTitle(_sampleTitle), color(_color), norm(_norm), inputfile(_inputfile), applyVariation(_applyVariation)
+{
+}
 
-  TFile *readfromfile;
+TFile* histSaver::readfile(TFile *_inputfile){
+  if(_inputfile) return _inputfile;
+  if(!inputfile) inputfile = new TFile(inputfilename + ".root", "read");
+  if(!inputfile) inputfile = new TFile(nominalfilename + ".root", "read");
+  return inputfile;
+}
 
-  if(_inputfile) readfromfile = _inputfile;
-  else{
-    if(!inputfile) inputfile = new TFile(inputfilename + ".root", "read");
-    if(!inputfile) inputfile = new TFile(nominalfilename + ".root", "read");
-    readfromfile = inputfile;
+void histSaver::indexkeys(TFile *file){
+  fileIndex &index = keyindex[file];
+  if(index.name == file->GetName() && index.uuid == file->GetUUID().AsString() && index.end == file->GetEND()) return;
+  index.name = file->GetName();
+  index.uuid = file->GetUUID().AsString();
+  index.end = file->GetEND();
+  index.cycles.clear();
+  deletepointer(index.cache);
+  if(usecache){
+    TString cachename = index.name + ".hcache";
+    if(!HistCache::uptodate(cachename, index.name)) write_filecache(file, cachename);
+    HistCache *cache = new HistCache();
+    if(cache->open(cachename)) {
+      index.cache = cache;
+      if(debug) printf("histSaver::indexkeys() : reading %s through %s\n", file->GetName(), cachename.Data());
+      return;
+    }
+    deletepointer(cache);
   }
-  TString filename(readfromfile->GetName());
-  if (debug == 1) printf("read from file: %s\n", filename.Data());
+  for(auto obj : *file->GetListOfKeys()){
+    TKey *key = (TKey*)obj;
+    auto inserted = index.cycles.insert(make_pair(string(key->GetName()), key->GetCycle()));
+    if(inserted.first->second < key->GetCycle()) inserted.first->second = key->GetCycle();
+  }
+  if(debug) printf("histSaver::indexkeys() : %lu keys in %s\n", index.cycles.size(), file->GetName());
+}
+
+void histSaver::forgetfile(TFile *file){
+  auto indexed = keyindex.find(file);
+  if(indexed == keyindex.end()) return;
+  deletepointer(indexed->second.cache);
+  keyindex.erase(indexed);
+}
+
+TH1D* histSaver::readhist(TFile *file, TString histname){
+  const fileIndex &index = keyindex.at(file);
+  if(index.cache){
+    const cacheEntry *entry = index.cache->find(histname);
+    return entry ? index.cache->hist(*entry) : 0;
+  }
+  auto cycle = index.cycles.find(histname.Data());
+  if(cycle == index.cycles.end()) return 0;
+  TKey *key = file->GetKey(histname, cycle->second);
+  if(!key) return 0;
+  TH1D *hist = (TH1D*)key->ReadObj();
+  hist->SetDirectory(0);
+  return hist;
+}
+
+TString histSaver::readhistname(TFile *file, TString savehistname, TString variation, TString region, bool applyVariation){
+  TString filename(file->GetName());
+  if(filename.Contains("NOMINAL") && variation.Contains("Xsec")) return savehistname + "_NOMINAL_" + region + "_";
+  return savehistname + "_" + (applyVariation?variation:"NOMINAL") + "_" + region + "_";
+}
+
+void histSaver::add_read(TString samplename, TString variation, TString sampleTitle, enum EColor color, double norm, TString region, int ivar, TString histname, TH1D *readhist){
+  if(!readhist) {
+    if(debug) printf("histogram name not found: %s\n", histname.Data());
+    return;
+  }
+  double tmp = readhist->Integral();
+  if(tmp!=tmp){
+    printf("Warning: %s->Integral() is nan, skip\n", histname.Data());
+    deletepointer(readhist);
+    return;
+  }
+  if(tmp==0){
+    printf("Warning: %s->Integral() is 0, skip\n", histname.Data());
+    deletepointer(readhist);
+    return;
+  }
+  if(checkread){
+    if(samplename == checkread_sample && region == checkread_region && variation == checkread_variation && ivar == checkread_variable){
+      printf("read histogram %s, + %f\n", histname.Data(), readhist->GetBinContent(checkread_ibin)*norm);
+    }
+  }
+  TH1D *&target = plot_lib[samplename][region][variation][ivar];
+  if(target){
+    target->Add(readhist,norm);
+    deletepointer(readhist);
+    return;
+  }
+  target = readhist;
+  target->SetName(samplename + "_" + variation + "_" + region + "_" + v.at(ivar)->name + "_buffer");
+  target->Scale(norm);
+  target->SetTitle(sampleTitle);
+  target->SetFillColorAlpha(color,1);
+  target->SetLineWidth(1);
+  target->SetLineColor(kBlack);
+  target->SetMarkerSize(0);
+}
+
+void histSaver::read_sample(TString samplename, TString savehistname, TString variation, TString sampleTitle, enum EColor color, double norm, TFile *_inputfile, bool applyVariation){
+  TFile *readfromfile = readfile(_inputfile);
+  if (debug == 1) printf("read from file: %s\n", readfromfile->GetName());
+  indexkeys(readfromfile);
   if (samplename == "data") dataref = 1;
-  TString histnameorig(savehistname + "_");
-  for(auto const& region: regions) {
-    TString histname;
-    if(filename.Contains("NOMINAL") && variation.Contains("Xsec")){
-      histname = histnameorig + "NOMINAL_" + region + "_";
-    }else{
-      histname = histnameorig + (applyVariation?variation:"NOMINAL") + "_" + region + "_";
+  if(lazyread){
+    lazySource source;
+    source.file = readfromfile;
+    source.sampleTitle = sampleTitle;
+    source.color = color;
+    source.norm = norm;
+    source.loaded.assign(v.size(), 0);
+    for(auto const& region: regions) {
+      source.histname = readhistname(readfromfile, savehistname, variation, region, applyVariation);
+      plot_lib[samplename][region][variation].resize(v.size(),0);
+      lazy_lib[samplename][region][variation].push_back(source);
     }
+    if(debug) printf("histSaver::read_sample() : %s registered from %s, read when grabbed\n", samplename.Data(), readfromfile->GetName());
+    return;
+  }
+  for(auto const& region: regions) {
+    TString histname = readhistname(readfromfile, savehistname, variation, region, applyVariation);
     if (debug == 1)
     {
       printf("read sample %s from %s region\n", samplename.Data(), region.Data());
     }
-    auto &samplib = plot_lib[samplename];
-    auto &regionlib = samplib[region];
-    bool newRegion = regionlib.size()==0;
-    for (int i = 0; i < v.size(); ++i)
+    plot_lib[samplename][region][variation].resize(v.size(),0);
+    for (int i : activevars(region))
     {
       if(debug) printf("histSaver::read_sample() : Read file %s to get %s\n",readfromfile->GetName(), (histname + v.at(i)->name).Data());
-      TH1D *readhist = (TH1D*)readfromfile->Get(histname + v.at(i)->name);
-      if(!readhist) {
-        if(debug) printf("histogram name not found: %s\n", (histname + v.at(i)->name).Data());
-        if(i == regionlib[variation].size()) regionlib[variation].push_back(0);
-        continue;
-      }
-      double tmp = readhist->Integral();
-      if(tmp!=tmp){
-        printf("Warning: %s->Integral() is nan, skip\n", (histname + v.at(i)->name).Data());
-        if(i == regionlib[variation].size()) regionlib[variation].push_back(0);
-        continue;
-      }
-      if(tmp==0){
-        printf("Warning: %s->Integral() is 0, skip\n", (histname + v.at(i)->name).Data());
-        if(i == regionlib[variation].size()) regionlib[variation].push_back(0);
-        continue;
+      add_read(samplename, variation, sampleTitle, color, norm, region, i, histname + v.at(i)->name, readhist(readfromfile, histname + v.at(i)->name));
+    }
+    if(debug) printf("histSaver::read_sample : finish read plot_lib[%s][%s][%s]\n", samplename.Data(),region.Data(),variation.Data());
+  }
+}
+
+void histSaver::loadlazy(TString sample, TString region, TString variation, int ivar){
+  auto samp = lazy_lib.find(sample);
+  if(samp == lazy_lib.end()) return;
+  auto reg = samp->second.find(region);
+  if(reg == samp->second.end()) return;
+  auto vari = reg->second.find(variation);
+  if(vari == reg->second.end() || ivar < 0 || ivar >= v.size() || !isactive(region, ivar)) return;
+  for(auto &source : vari->second){
+    if(source.loaded[ivar]) continue;
+    source.loaded[ivar] = 1;
+    TString histname = source.histname + v.at(ivar)->name;
+    if(debug) printf("histSaver::loadlazy() : Read file %s to get %s\n", source.file->GetName(), histname.Data());
+    add_read(sample, variation, source.sampleTitle, source.color, source.norm, region, ivar, histname, readhist(source.file, histname));
+  }
+}
+
+void histSaver::load_lazy(){
+  if(!lazy_lib.size()) return;
+  long nsource = 0;
+  for(auto &samp : lazy_lib)
+    for(auto &reg : samp.second)
+      for(auto &vari : reg.second){
+        for (int i = 0; i < v.size(); ++i) loadlazy(samp.first, reg.first, vari.first, i);
+        nsource += vari.second.size();
       }
-      if(checkread){
-        if(samplename == checkread_sample && region == checkread_region && variation == checkread_variation && i == checkread_variable){
-          printf("read histogram %s, + %f\n", (histname + v.at(i)->name).Data(), readhist->GetBinContent(checkread_ibin)*norm);
+  lazy_lib.clear();
+  if(debug) printf("histSaver::load_lazy() : %ld registered reads loaded\n", nsource);
+}
+
+void histSaver::write_filecache(TFile *file, TString cachename){
+  HistCache cache;
+  HistCache::stamp(file->GetName(), cache.sourcestamp);
+  set<TString> cached;
+  for(auto obj : *file->GetListOfKeys()){
+    TKey *key = (TKey*)obj;
+    if(!TString(key->GetClassName()).BeginsWith("TH1") || !cached.insert(key->GetName()).second) continue;
+    TH1 *hist = (TH1*)file->Get(key->GetName()); //the highest cycle
+    cache.add(key->GetName(), hist);
+    hist->SetDirectory(0);
+    deletepointer(hist);
+  }
+  if(cache.write(cachename)) printf("histSaver::write_filecache() : %s written\n", cachename.Data());
+}
+
+void histSaver::dump_cache(TString filename){
+  load_lazy();
+  sync_slots();
+  HistCache cache;
+  for(auto const& sample : samples) cache.add_sample(sample.name, sample.title, sample.color);
+  long nhist = 0;
+  for(auto& sample : plot_lib)
+    for(auto& region: sample.second)
+      for(auto& variation : region.second)
+        for (int i = 0; i < variation.second.size() && i < v.size(); ++i){
+          if(!variation.second[i]) continue;
+          cache.add(variation.second[i]->GetName(), variation.second[i], sample.first, region.first, variation.first, v.at(i)->name);
+          nhist++;
         }
+  if(cache.write(filename)) printf("histSaver::dump_cache() : %ld histograms written to %s\n", nhist, filename.Data());
+}
+
+bool histSaver::load_cache(TString filename){
+  HistCache cache;
+  if(!cache.open(filename)) {
+    printf("histSaver::load_cache() ERROR: cannot open %s\n", filename.Data());
+    return 0;
+  }
+  merge_cache(cache, 0);
+  printf("histSaver::load_cache() : %ld histograms loaded from %s\n", cache.header->nhist, filename.Data());
+  return 1;
+}
+
+void histSaver::merge_cache(HistCache &cache, bool add){
+  for (int i = 0; i < cache.header->nsample; ++i){
+    TString name = cache.text(cache.samples[i].name);
+    if(find_if(samples.begin(),samples.end(),[name](fcncSample const& tmp){return name == tmp.name;}) == samples.end())
+      add_sample(name, cache.text(cache.samples[i].title), (enum EColor)cache.samples[i].color);
+  }
+  for (long ientry = 0; ientry < cache.header->nhist; ++ientry){
+    const cacheEntry &entry = cache.entries[ientry];
+    TString varname = cache.text(entry.varname);
+    int ivar = -1;
+    for (int i = 0; i < v.size(); ++i) if(v[i]->name == varname) ivar = i;
+    if(ivar < 0) {
+      if(debug) printf("histSaver::merge_cache() : variable %s not defined, skip\n", varname.Data());
+      continue;
+    }
+    TString region = cache.text(entry.region);
+    if(find(regions.begin(), regions.end(), region) == regions.end()) add_region(region);
+    auto &hists = plot_lib[cache.text(entry.sample)][region][cache.text(entry.variation)];
+    hists.resize(v.size(),0);
+    TH1D *loaded = cache.hist(entry);
+    if(add && hists[ivar]) {
+      hists[ivar]->Add(loaded);
+      deletepointer(loaded);
+    }else{
+      deletepointer(hists[ivar]);
+      hists[ivar] = loaded;
+    }
+  }
+}
+
+TString histSaver::fingerprint(TString config){
+  TString description;
+  for (int i = 0; i < v.size(); ++i){
+    description += TString::Format("%s %d %.9g %.9g %.9g;", v[i]->name.Data(), v[i]->nbins, v[i]->xlow, v[i]->xhigh, v[i]->scale);
+    if(v[i]->xbins) for(auto edge : *v[i]->xbins) description += TString::Format("%.9g ", edge);
+    description += TString(bindings[i].type) + ";";
+  }
+  description += "|";
+  for(auto const& region : regions) {
+    description += region + ":";
+    for(auto i : activevars(region)) description += TString::Format("%d ", i);
+  }
+  description += "|";
+  for(auto const& sample : samples) description += TString::Format("%s %.9g;", sample.name.Data(), sample.norm);
+  description += "|";
+  for(auto const& variation : weightvariations) description += variation + " ";
+  description += TString::Format("|%d|", weight_type) + config;
+  return TString::Format("%016llx", HistCache::hash(description.Data(), description.Length()));
+}
+
+unsigned long long histSaver::inputhash(TString inputname){
+  struct stat st;
+  if(stat(inputname.Data(), &st)) return 0;
+  //hashing the content is only repeated when the file was touched
+  TString memoname = partialdir + "/inputhashes.txt";
+  TString key = TString::Format("%lld %lld.%09ld %s", (long long)st.st_size, (long long)st.st_mtim.tv_sec, (long)st.st_mtim.tv_nsec, inputname.Data());
+  ifstream memo(memoname.Data());
+  string line;
+  while(getline(memo, line)){
+    size_t split = line.find(' ');
+    if(split != string::npos && key == line.substr(split+1).c_str()) return stoull(line.substr(0, split), 0, 16);
+  }
+  memo.close();
+  unsigned long long ret = HistCache::filehash(inputname);
+  ofstream append(memoname.Data(), ios::app);
+  append << TString::Format("%016llx ", ret).Data() << key.Data() << endl;
+  return ret;
+}
+
+bool histSaver::begin_input(TString inputname, TString config){
+  if(partialname != "") {
+    printf("histSaver::begin_input() ERROR: end_input() was not called for %s\n", partialname.Data());
+    exit(0);
+  }
+  gSystem->mkdir(partialdir, 1);
+  unsigned long long content = inputhash(inputname);
+  if(!content) {
+    printf("histSaver::begin_input() WARNING: cannot read %s, it is filled without keeping a partial\n", inputname.Data());
+    return 1;
+  }
+  TString name = partialdir + TString::Format("/%016llx_", content) + fingerprint(config) + ".hcache";
+  HistCache cache;
+  if(cache.open(name)) {
+    merge_cache(cache, 1);
+    printf("histSaver::begin_input() : %s unchanged, %ld histograms added from %s\n", inputname.Data(), cache.header->nhist, name.Data());
+    return 0;
+  }
+  partialname = name;
+  //the input is filled from empty histograms, created on its first fills (see fill_hist() and slotbins())
+  sync_slots();
+  partialbase.clear();
+  for(auto& sample : plot_lib)
+    for(auto& region: sample.second)
+      for(auto& variation : region.second){
+        auto &hists = variation.second;
+        if(find_if(hists.begin(), hists.end(), [](TH1D *hist){ return hist != 0; }) == hists.end()) continue;
+        partialbase.push_back(make_pair(&hists, hists));
+        hists.assign(hists.size(), 0);
       }
-      bool newhist = 0;
-      TH1D* target;
-      if(newRegion) {
-        target = (TH1D*)(readfromfile->Get(histname + v.at(i)->name)->Clone());
-        regionlib[variation].push_back(target);
-      }else {
-        auto &tmp = regionlib[variation];
-        target = tmp[i];
-        if(!target) {
-          target = (TH1D*)(readfromfile->Get(histname + v.at(i)->name)->Clone());
-          tmp[i] = target;
-        }else{
-          target->Add(readhist,norm);
-          continue;
+  return 1;
+}
+
+void histSaver::end_input(){
+  if(partialname == "") return;
+  sync_slots();
+  HistCache cache;
+  long nhist = 0;
+  for(auto& sample : plot_lib)
+    for(auto& region: sample.second)
+      for(auto& variation : region.second)
+        for (int i = 0; i < variation.second.size() && i < v.size(); ++i){
+          TH1D *hist = variation.second[i];
+          if(!hist) continue;
+          //as loaded from the partial by merge_cache(), so a rerun adds exactly the same histogram
+          double entries = hist->GetEntries();
+          hist->ResetStats();
+          hist->SetEntries(entries);
+          bool filled = entries != 0;
+          for (int ib = 0; ib < hist->GetNbinsX()+2 && !filled; ++ib) filled = hist->GetArray()[ib] != 0;
+          if(!filled) continue;
+          cache.add(hist->GetName(), hist, sample.first, region.first, variation.first, v.at(i)->name);
+          nhist++;
         }
+  if(cache.write(partialname)) printf("histSaver::end_input() : %ld histograms kept in %s\n", nhist, partialname.Data());
+  //add back what was filled before the input
+  for(auto &base : partialbase){
+    auto &hists = *base.first;
+    for (int i = 0; i < base.second.size() && i < hists.size(); ++i){
+      if(!base.second[i]) continue;
+      if(hists[i]) {
+        base.second[i]->Add(hists[i]);
+        deletepointer(hists[i]);
       }
-      target->SetName(samplename + "_" + variation + "_" + region + "_" + v.at(i)->name + "_buffer");
-      target->Scale(norm);
-      target->SetTitle(sampleTitle);
-      target->SetFillColorAlpha(color,1);
-      target->SetLineWidth(1);
-      target->SetLineColor(kBlack);
-      target->SetMarkerSize(0);
-      target->SetDirectory(0);
+      hists[i] = base.second[i];
     }
-    if(debug) printf("histSaver::read_sample : finish read plot_lib[%s][%s][%s][%d]", samplename.Data(),region.Data(),variation.Data(),regionlib[variation].size());
   }
+  partialname = "";
+  partialbase.clear();
+}
+
+void histSaver::read_samples(vector<sampleRead> &reads, int nthreads){
+  auto start = chrono::steady_clock::now();
+  if(lazyread){
+    //nothing is read here, registering is cheap
+    for(auto &read : reads) read_sample(read.samplename, read.savehistname, read.variation, read.sampleTitle, read.color, read.norm, read.inputfile, read.applyVariation);
+    return;
+  }
+  vector<TFile*> files;
+  map<TFile*, vector<int>> filereads;
+  for (int k = 0; k < reads.size(); ++k){
+    TFile *file = readfile(reads[k].inputfile);
+    reads[k].inputfile = file;
+    if(filereads.find(file) == filereads.end()) {
+      files.push_back(file);
+      indexkeys(file);
+    }
+    filereads[file].push_back(k);
+    reads[k].hists.assign(regions.size(), vector<TH1D*>(v.size(),0));
+  }
+  vector<vector<int>> active;
+  for(auto const& region: regions) active.push_back(activevars(region));
+  //one reader per file, nothing shared is modified here
+  auto readfrom = [&](TFile *file){
+    for(auto k : filereads.at(file)){
+      sampleRead &read = reads[k];
+      for (int ireg = 0; ireg < regions.size(); ++ireg){
+        TString histname = readhistname(file, read.savehistname, read.variation, regions[ireg], read.applyVariation);
+        for(auto i : active[ireg]) read.hists[ireg][i] = readhist(file, histname + v.at(i)->name);
+      }
+    }
+  };
+  if(nthreads <= 0) nthreads = thread::hardware_concurrency();
+  if(nthreads > files.size()) nthreads = files.size();
+  if(nthreads <= 1) {
+    for(auto file : files) readfrom(file);
+  }else{
+    ROOT::EnableThreadSafety();
+    atomic<int> nextfile(0);
+    vector<thread> workers;
+    for (int ithread = 0; ithread < nthreads; ++ithread)
+      workers.emplace_back([&](){
+        for(int ifile = nextfile++; ifile < files.size(); ifile = nextfile++) readfrom(files[ifile]);
+      });
+    for(auto &worker : workers) worker.join();
+  }
+  //added in the order of the requests, the same result as calling read_sample() for each
+  for(auto &read : reads){
+    if (read.samplename == "data") dataref = 1;
+    for (int ireg = 0; ireg < regions.size(); ++ireg){
+      TString histname = readhistname(read.inputfile, read.savehistname, read.variation, regions[ireg], read.applyVariation);
+      plot_lib[read.samplename][regions[ireg]][read.variation].resize(v.size(),0);
+      for(auto i : active[ireg]) add_read(read.samplename, read.variation, read.sampleTitle, read.color, read.norm, regions[ireg], i, histname + v.at(i)->name, read.hists[ireg][i]);
+    }
+    read.hists.clear();
+  }
+  printf("histSaver::read_samples() : %lu samples from %lu files with %d threads in %4.2f s\n", reads.size(), files.size(), max(nthreads,1), chrono::duration<double>(chrono::steady_clock::now() - start).count());
 }
 
 void histSaver::add_region(TString region){
@@ -732,6 +1228,10 @@ void histSaver::add_region(TString region){
 }
 
 void histSaver::fill_hist(TString sample, TString region, TString variation){
+  if(usearena) {
+    fill_hist(book(sample, region, variation));
+    return;
+  }
   auto sampleiter = plot_lib.find(sample);
   if(sampleiter == plot_lib.end()) {
     printf("histSaver::fill_hist() ERROR: sample %s not found\n", sample.Data());
@@ -751,25 +1251,23 @@ void histSaver::fill_hist(TString sample, TString region, TString variation){
   }
 
 
-  for (int i = 0; i < v.size(); ++i){
+  auto &reglib = sampleiter->second[region];
+  if(reglib.find(variation) == reglib.end()) {
+    if(!add_variation(sample,region,variation)) printf("add variation %s failed, sample %s doesnt exist\n", variation.Data(), sample.Data());
+  }
+  double weight = weight_type == 1? *fweight : *dweight;
+  auto &hists = reglib[variation];
+  for (int i : activevars(region)){
     double fillval = getVal(i);
     if(fillval!=fillval) {
       printf("Warning: fill val is nan: \n");
-      printf("plot_lib[%s][%s][%d]->Fill(%4.2f,%4.2f)\n", sample.Data(), region.Data(), i, fillval, weight_type == 1? *fweight : *dweight);
+      printf("plot_lib[%s][%s][%d]->Fill(%4.2f,%4.2f)\n", sample.Data(), region.Data(), i, fillval, weight);
     }
-    if(debug == 1) printf("plot_lib[%s][%s][%s][%d]->Fill(%4.2f,%4.2f)\n", sample.Data(), region.Data(), variation.Data(), i, fillval, weight_type == 1? *fweight : *dweight);
-    TH1D *target = grabhist(sample,region,variation,i);
-    if(target) target->Fill(fillval,weight_type == 1? *fweight : *dweight);
-    else {
-      if(!add_variation(sample,region,variation)) printf("add variation %s failed, sample %s doesnt exist\n", variation.Data(), sample.Data());
-      TH1D *target = grabhist(sample,region,variation,i);
-      if(target) target->Fill(fillval,weight_type == 1? *fweight : *dweight);
-      else {
-        printf("add_variation didnt work in filling sample %s, region %s, variation %s, variable %s\n",sample.Data(),region.Data(),variation.Data(),v[i]->name.Data());
-        show();
-        exit(0);
-      }
+    if(!hists[i]) {
+      checkcompleted(sample, variation);
+      hists[i] = newhist(sample, region, variation, i);
     }
+    hists[i]->Fill(fillval,weight);
   }
 }
 
@@ -777,6 +1275,499 @@ void histSaver::fill_hist(TString sample, TString region){
   fill_hist(sample, region, "NOMINAL");
 }
 
+FillHandle histSaver::book(TString sample, TString region, TString variation){
+  auto &islot = slot_lib[sample][region];
+  auto slotiter = islot.find(variation);
+  if(slotiter != islot.end()) return FillHandle(slotiter->second);
+  auto sampleiter = plot_lib.find(sample);
+  if(sampleiter == plot_lib.end()) {
+    printf("histSaver::book() ERROR: sample %s not found\n", sample.Data());
+    show();
+    exit(0);
+  }
+  if(sharedbins) {
+    printf("histSaver::book() ERROR: plot_lib[%s][%s][%s] booked after share_bins(), book every slot before\n", sample.Data(), region.Data(), variation.Data());
+    //non-zero: a forked worker meeting it is a failed job, its events would be lost silently otherwise
+    exit(1);
+  }
+  fillSlot slot;
+  slot.sample = sample;
+  slot.region = region;
+  slot.variation = variation;
+  slot.entries = 0;
+  slot.sharedentries = 0;
+  slot.ivars = activevars(region);
+  slot.completed = iscompleted(sample, variation);
+  if(usearena){
+    if(!arena) arena = new HistArena();
+    if(outputfile.find(variation) == outputfile.end()) openoutput(variation);
+    if(find(regions.begin(), regions.end(), region) == regions.end()) {
+      regions.push_back(region);
+      nregion += 1;
+    }
+    if (sample == "data") dataref = 1;
+    slot.hists = &sampleiter->second[region][variation];
+    slot.hists->resize(v.size(),0);
+    fillbooked.insert(slot.hists);
+    //arena blocks are allocated on the first fill, see slotbins()
+    slot.sumw.resize(v.size(),0);
+    slot.sumw2.resize(v.size(),0);
+  }else{
+    if(sampleiter->second.find(region) == sampleiter->second.end()){
+      init_hist(sampleiter, region, variation);
+      if(find(regions.begin(), regions.end(), region) == regions.end()) {
+        regions.push_back(region);
+        nregion += 1;
+      }
+    }
+    auto &reglib = sampleiter->second[region];
+    if(reglib.find(variation) == reglib.end()) {
+      if(!add_variation(sample,region,variation)) printf("add variation %s failed, sample %s doesnt exist\n", variation.Data(), sample.Data());
+    }
+    slot.hists = &reglib[variation];
+    for(auto hist : *slot.hists) if(hist && !hist->GetSumw2N()) hist->Sumw2();
+  }
+  slots.push_back(slot);
+  islot[variation] = slots.size()-1;
+  //an index entry made before the booking has no slot yet
+  int isample = sampleids.find(sample), iregion = findregion(region), ivariation = variationids.find(variation);
+  if(isample >= 0 && iregion >= 0 && ivariation >= 0){
+    auto indexed = histindex.find(histkey(isample, iregion, ivariation));
+    if(indexed != histindex.end()) indexed->second.second = slots.size()-1;
+  }
+  if(debug) printf("histSaver::book() : slot %lu for plot_lib[%s][%s][%s]\n", slots.size()-1, sample.Data(), region.Data(), variation.Data());
+  return FillHandle(slots.size()-1);
+}
+
+void histSaver::fill_hist(FillHandle handle){
+  if(!handle.valid() || handle.islot >= slots.size()) {
+    printf("histSaver::fill_hist() ERROR: invalid fill handle %d, call book() first\n", handle.islot);
+    exit(0);
+  }
+  if (weight_type == 0)
+  {
+    printf("histSaver::fill_hist() ERROR: weight not set\n");
+    exit(0);
+  }
+  double weight = weight_type == 1? *fweight : *dweight;
+  fillSlot &slot = slots[handle.islot];
+  if(slot.completed) checkcompleted(slot.sample, slot.variation);
+  double *sumw, *sumw2;
+  if(slot.sumw.size()){
+    for (int i : slot.ivars){
+      slotbins(slot, i, sumw, sumw2, 1);
+      addbin(sumw, sumw2, v[i]->findbin(getVal(i)), weight);
+    }
+    addentries(slot, 1);
+    return;
+  }
+  TH1D **hists = slot.hists->data();
+  for (int i : slot.ivars){
+    if(!hists[i]) {
+      hists[i] = newhist(slot.sample, slot.region, slot.variation, i);
+    }
+    hists[i]->Fill(getVal(i),weight);
+  }
+}
+
+bool histSaver::slotbins(fillSlot &slot, int ivar, double *&sumw, double *&sumw2, bool create){
+  if(slot.sumw.size()){
+    if(!slot.sumw[ivar]){
+      if(!create) return 0;
+      int nbins = v.at(ivar)->nbins;
+      slot.sumw[ivar] = arena->allocate(2*(nbins+2));
+      slot.sumw2[ivar] = slot.sumw[ivar] + nbins + 2;
+    }
+    sumw = slot.sumw[ivar];
+    sumw2 = slot.sumw2[ivar];
+    return 1;
+  }
+  TH1D *&target = (*slot.hists)[ivar];
+  if(!target){
+    if(!create) return 0;
+    checkcompleted(slot.sample, slot.variation);
+    target = newhist(slot.sample, slot.region, slot.variation, ivar);
+  }
+  sumw = target->GetArray();
+  sumw2 = target->GetSumw2()->GetArray();
+  return 1;
+}
+
+void histSaver::share_bins(){
+  if(!usearena) {
+    printf("histSaver::share_bins() ERROR: set usearena = 1 before booking\n");
+    exit(0);
+  }
+  if(sharedbins) return;
+  HistArena *shared = new HistArena(arena ? arena->pagesize : 1<<20, 1);
+  double *entries = shared->allocate(slots.size());
+  long ndouble = 0;
+  for (int islot = 0; islot < slots.size(); ++islot){
+    fillSlot &slot = slots[islot];
+    for (int i : slot.ivars){
+      int nbins = v.at(i)->nbins;
+      double *block = shared->allocate(2*(nbins+2));
+      if(slot.sumw[i]) {
+        memcpy(block, slot.sumw[i], (nbins+2)*sizeof(double));
+        memcpy(block+nbins+2, slot.sumw2[i], (nbins+2)*sizeof(double));
+      }
+      slot.sumw[i] = block;
+      slot.sumw2[i] = block+nbins+2;
+      ndouble += 2*(nbins+2);
+    }
+    slot.sharedentries = entries + islot;
+  }
+  deletepointer(arena);
+  arena = shared;
+  sharedbins = 1;
+  printf("histSaver::share_bins() : %lu slots, %4.2f MB in shared memory\n", slots.size(), (ndouble + slots.size())*sizeof(double)/1048576.);
+}
+
+int histSaver::findregion(TString region){
+  if(nregionindexed != regions.size()){
+    for (; nregionindexed < regions.size(); ++nregionindexed)
+      regionindex.insert(make_pair(string(regions[nregionindexed].Data()), nregionindexed));
+  }
+  auto iter = regionindex.find(region.Data());
+  return iter == regionindex.end() ? -1 : iter->second;
+}
+
+RegionHandle histSaver::book_regions(TString sample, TString variation){
+  if(plot_lib.find(sample) == plot_lib.end()) {
+    printf("histSaver::book_regions() ERROR: sample %s not found\n", sample.Data());
+    show();
+    exit(0);
+  }
+  RegionHandle handle;
+  handle.sample = sample;
+  handle.variation = variation;
+  handle.islots.resize(regions.size(), -1);
+  return handle;
+}
+
+void histSaver::fill_hist(RegionHandle &handle, ULong64_t regionmask){
+  vector<int> &regionids = fanoutregions;
+  regionids.clear();
+  for (int ireg = 0; regionmask; ++ireg, regionmask >>= 1)
+    if(regionmask & 1) regionids.push_back(ireg);
+  fill_hist(handle, regionids);
+}
+
+void histSaver::fill_hist(RegionHandle &handle, BelongRegion &belongregion){
+  vector<int> &regionids = fanoutregions;
+  regionids.clear();
+  for(auto const& region : belongregion.m_all_region){
+    int ireg = findregion(region);
+    if(ireg < 0) {
+      add_region(region);
+      ireg = findregion(region);
+    }
+    regionids.push_back(ireg);
+  }
+  fill_hist(handle, regionids);
+}
+
+void histSaver::fill_hist(RegionHandle &handle, const vector<int> &regionids){
+  if(!regionids.size()) return;
+  if (weight_type == 0)
+  {
+    printf("histSaver::fill_hist() ERROR: weight not set\n");
+    exit(0);
+  }
+  double weight = weight_type == 1? *fweight : *dweight;
+  if(handle.islots.size() < regions.size()) handle.islots.resize(regions.size(), -1);
+  for(auto ireg : regionids){
+    if(ireg < 0 || ireg >= regions.size()) {
+      printf("histSaver::fill_hist() ERROR: region id %d out of range, %lu regions defined\n", ireg, regions.size());
+      exit(0);
+    }
+    if(handle.islots[ireg] < 0) handle.islots[ireg] = book(handle.sample, regions[ireg], handle.variation).islot;
+  }
+  //bins of the variables active in any of the regions, computed once
+  fillbins.assign(v.size(), -1);
+  double *sumw, *sumw2;
+  for(auto ireg : regionids){
+    fillSlot &slot = slots[handle.islots[ireg]];
+    for (int i : slot.ivars){
+      slotbins(slot, i, sumw, sumw2, 1);
+      if(fillbins[i] < 0) fillbins[i] = v[i]->findbin(getVal(i));
+      addbin(sumw, sumw2, fillbins[i], weight);
+    }
+    addentries(slot, 1);
+  }
+}
+
+void histSaver::add_weight_variation(TString variation, Float_t* _weight){
+  weightvariations.push_back(variation);
+  fweightvariations.push_back(_weight);
+  dweightvariations.push_back(0);
+}
+
+void histSaver::add_weight_variation(TString variation, Double_t* _weight){
+  weightvariations.push_back(variation);
+  fweightvariations.push_back(0);
+  dweightvariations.push_back(_weight);
+}
+
+FanoutHandle histSaver::book_fanout(TString sample, TString region, TString nominal){
+  return book_fanout(sample, region, nominal, weightvariations);
+}
+
+FanoutHandle histSaver::book_fanout(TString sample, TString region, TString nominal, vector<TString> variations){
+  FanoutHandle handle;
+  handle.islots.push_back(book(sample, region, nominal).islot);
+  handle.iweights.push_back(-1);
+  for(auto variation : variations){
+    handle.islots.push_back(book(sample, region, variation).islot);
+    handle.iweights.push_back(findi(weightvariations, variation));
+  }
+  return handle;
+}
+
+void histSaver::fill_hist(const FanoutHandle &handle){
+  if (weight_type == 0)
+  {
+    printf("histSaver::fill_hist() ERROR: weight not set\n");
+    exit(0);
+  }
+  int nslot = handle.islots.size();
+  fanoutweights.resize(nslot);
+  double *weights = fanoutweights.data();
+  weights[0] = weight_type == 1? *fweight : *dweight;
+  for (int k = 1; k < nslot; ++k){
+    int iweight = handle.iweights[k];
+    if(iweight < 0) {
+      printf("histSaver::fill_hist() ERROR: weight of variation %s not registered, use add_weight_variation() or pass the weights\n", slots[handle.islots[k]].variation.Data());
+      exit(0);
+    }
+    weights[k] = fweightvariations[iweight] ? *fweightvariations[iweight] : *dweightvariations[iweight];
+  }
+  fill_hist(handle, weights);
+}
+
+void histSaver::fill_hist(const FanoutHandle &handle, const double *weights){
+  int nslot = handle.islots.size();
+  const int *islots = handle.islots.data();
+  double *sumw, *sumw2;
+  for (int i : slots[islots[0]].ivars){
+    int bin = v[i]->findbin(getVal(i));
+    for (int k = 0; k < nslot; ++k){
+      slotbins(slots[islots[k]], i, sumw, sumw2, 1);
+      addbin(sumw, sumw2, bin, weights[k]);
+    }
+  }
+  for (int k = 0; k < nslot; ++k) addentries(slots[islots[k]], 1);
+}
+
+template<typename T>
+void histSaver::fill_columns(FillHandle handle, const vector<const T*> &values, const double *weights, long nevents){
+  if(!handle.valid() || handle.islot >= slots.size()) {
+    printf("histSaver::fill_batch() ERROR: invalid fill handle %d, call book() first\n", handle.islot);
+    exit(0);
+  }
+  if(values.size() != v.size()) {
+    printf("histSaver::fill_batch() ERROR: %lu columns given for %lu variables\n", values.size(), v.size());
+    exit(0);
+  }
+  if(nevents <= 0) return;
+  fillSlot &slot = slots[handle.islot];
+  double *sumw, *sumw2;
+  vector<double> local;
+  for (int i : slot.ivars){
+    binRange range(v[i]);
+    slotbins(slot, i, sumw, sumw2, 1);
+    if(!sharedbins) {
+      fill_column(range, values[i], weights, nevents, sumw, sumw2);
+      continue;
+    }
+    //filled locally, then one atomic add per bin
+    int nbins = v[i]->nbins;
+    local.assign(2*(nbins+2), 0);
+    fill_column(range, values[i], weights, nevents, local.data(), local.data()+nbins+2);
+    for (int ib = 0; ib < nbins+2; ++ib) if(local[ib] != 0 || local[nbins+2+ib] != 0) {
+      atomic_add(sumw+ib, local[ib]);
+      atomic_add(sumw2+ib, local[nbins+2+ib]);
+    }
+  }
+  addentries(slot, nevents);
+}
+
+void histSaver::fill_batch(FillHandle handle, const vector<const float*> &values, const double *weights, long nevents){
+  fill_columns(handle, values, weights, nevents);
+}
+
+void histSaver::fill_batch(FillHandle handle, const vector<const double*> &values, const double *weights, long nevents){
+  fill_columns(handle, values, weights, nevents);
+}
+
+void histSaver::fill_batch(TString sample, TString region, TString variation, const vector<const float*> &values, const double *weights, long nevents){
+  fill_columns(book(sample, region, variation), values, weights, nevents);
+}
+
+void histSaver::fill_batch(TString sample, TString region, TString variation, const vector<const double*> &values, const double *weights, long nevents){
+  fill_columns(book(sample, region, variation), values, weights, nevents);
+}
+
+void histSaver::fill_batch(FillHandle handle, const vector<const int*> &values, const double *weights, long nevents){
+  fill_columns(handle, values, weights, nevents);
+}
+
+void histSaver::fill_batch(TString sample, TString region, TString variation, const vector<const int*> &values, const double *weights, long nevents){
+  fill_columns(book(sample, region, variation), values, weights, nevents);
+}
+
+int histSaver::findslot(TString sample, TString region, TString variation){
+  auto samp = slot_lib.find(sample);
+  if(samp == slot_lib.end()) return -1;
+  auto reg = samp->second.find(region);
+  if(reg == samp->second.end()) return -1;
+  auto vari = reg->second.find(variation);
+  if(vari == reg->second.end()) return -1;
+  return vari->second;
+}
+
+void histSaver::sync_slot(int islot, int ivar){
+  if(ivar >= (int)v.size()) return;
+  fillSlot &slot = slots[islot];
+  auto &hists = *slot.hists;
+  bool inarena = slot.sumw.size();
+  if(slot.sharedentries) {
+    slot.entries += *slot.sharedentries;
+    *slot.sharedentries = 0;
+  }
+  if(!inarena && !slot.entries) return;
+  if(hists.size() < v.size()) hists.resize(v.size(),0);
+  if(slot.synced.size() < v.size()) slot.synced.resize(v.size(),0);
+  int first = ivar < 0 ? 0 : ivar, last = ivar < 0 ? v.size() : ivar+1;
+  for (int i = first; i < last; ++i){
+    double entries = slot.entries - slot.synced[i];
+    slot.synced[i] = slot.entries;
+    if(inarena && !hists[i] && slot.sumw[i]) hists[i] = newhist(slot.sample, slot.region, slot.variation, i);
+    if(!entries || !hists[i]) continue;
+    if(inarena && slot.sumw[i]){
+      if(!hists[i]->GetSumw2N()) hists[i]->Sumw2();
+      double *content = hists[i]->GetArray();
+      double *error2 = hists[i]->GetSumw2()->GetArray();
+      for (int ib = 0; ib < v.at(i)->nbins+2; ++ib){
+        content[ib] += slot.sumw[i][ib];
+        error2[ib] += slot.sumw2[i][ib];
+        slot.sumw[i][ib] = 0;
+        slot.sumw2[i][ib] = 0;
+      }
+    }
+    entries += hists[i]->GetEntries();
+    hists[i]->ResetStats();
+    hists[i]->SetEntries(entries);
+  }
+  if(ivar >= 0) return;
+  slot.entries = 0;
+  slot.synced.assign(slot.synced.size(), 0);
+}
+
+void histSaver::sync_slots(){
+  for (int i = 0; i < slots.size(); ++i) sync_slot(i);
+}
+
+void histSaver::add_to_slot(int islot, double **sumw, double **sumw2, double entries){
+  fillSlot &slot = slots[islot];
+  double *target, *target2;
+  for (int i : slot.ivars){
+    slotbins(slot, i, target, target2, 1); //also for zero weights: the entries count every fill
+    if(sharedbins) {
+      for (int ib = 0; ib < v.at(i)->nbins+2; ++ib) if(sumw[i][ib] != 0 || sumw2[i][ib] != 0) {
+        atomic_add(target+ib, sumw[i][ib]);
+        atomic_add(target2+ib, sumw2[i][ib]);
+      }
+      continue;
+    }
+    for (int ib = 0; ib < v.at(i)->nbins+2; ++ib){
+      target[ib] += sumw[i][ib];
+      target2[ib] += sumw2[i][ib];
+    }
+  }
+  addentries(slot, entries);
+}
+
+void histSaver::merge_shard(FillShard *shard){
+  if(shard->direct){
+    for (int islot = 0; islot < shard->entries.size(); ++islot)
+      if(shard->entries[islot]) addentries(slots[islot], shard->entries[islot]);
+    shard->clear();
+    return;
+  }
+  for (int islot = 0; islot < shard->sumw.size(); ++islot){
+    if(!shard->sumw[islot].size() || !shard->entries[islot]) continue;
+    add_to_slot(islot, shard->sumw[islot].data(), shard->sumw2[islot].data(), shard->entries[islot]);
+  }
+  shard->clear();
+}
+
+void histSaver::merge_shards(vector<FillShard*> shards){
+  for(auto shard : shards) merge_shard(shard);
+}
+
+void histSaver::fill_parallel(Long64_t nentries, int nthreads, function<void(FillShard*, int, Long64_t, Long64_t)> fillrange, int nchunks){
+  //one shard per entry chunk, merged in chunk order: the result does not depend on nthreads
+  if(nthreads <= 0) nthreads = thread::hardware_concurrency();
+  if(nchunks > nentries) nchunks = nentries;
+  if(nchunks <= 0) return;
+  ROOT::EnableThreadSafety();
+  vector<FillShard*> shards(nchunks, 0);
+  vector<bool> done(nchunks, 0);
+  int nextmerge = 0;
+  atomic<int> nextchunk(0);
+  mutex mergelock;
+  auto worker = [&](int ithread){
+    for(;;){
+      int ichunk = nextchunk++;
+      if(ichunk >= nchunks) return;
+      FillShard *shard = new FillShard(this);
+      fillrange(shard, ithread, nentries*ichunk/nchunks, nentries*(ichunk+1)/nchunks);
+      lock_guard<mutex> lock(mergelock);
+      shards[ichunk] = shard;
+      done[ichunk] = 1;
+      while(nextmerge < nchunks && done[nextmerge]){
+        merge_shard(shards[nextmerge]);
+        deletepointer(shards[nextmerge]);
+        nextmerge++;
+      }
+    }
+  };
+  vector<thread> threads;
+  for (int i = 0; i < nthreads; ++i) threads.emplace_back(worker, i);
+  for(auto &th : threads) th.join();
+  if(debug) printf("histSaver::fill_parallel() : filled %lld entries in %d chunks with %d threads\n", nentries, nchunks, nthreads);
+}
+
+void histSaver::fill_atomic(Long64_t nentries, int nthreads, function<void(FillShard*, int, Long64_t, Long64_t)> fillrange, int nchunks){
+  if(nthreads <= 0) nthreads = thread::hardware_concurrency();
+  if(nchunks > nentries) nchunks = nentries;
+  if(nchunks <= 0) return;
+  ROOT::EnableThreadSafety();
+  //lazy allocation is not thread safe: every active block of the booked slots exists before the threads start
+  double *sumw, *sumw2;
+  for(auto &slot : slots)
+    for (int i : slot.ivars) slotbins(slot, i, sumw, sumw2, 1);
+  vector<FillShard*> shards;
+  for (int i = 0; i < nthreads; ++i) shards.push_back(new FillShard(this, 1));
+  atomic<int> nextchunk(0);
+  auto worker = [&](int ithread){
+    for(;;){
+      int ichunk = nextchunk++;
+      if(ichunk >= nchunks) return;
+      fillrange(shards[ithread], ithread, nentries*ichunk/nchunks, nentries*(ichunk+1)/nchunks);
+    }
+  };
+  vector<thread> threads;
+  for (int i = 0; i < nthreads; ++i) threads.emplace_back(worker, i);
+  for(auto &th : threads) th.join();
+  for(auto &shard : shards){
+    merge_shard(shard);
+    deletepointer(shard);
+  }
+  if(debug) printf("histSaver::fill_atomic() : filled %lld entries in %d chunks with %d threads\n", nentries, nchunks, nthreads);
+}
+
 
 bool histSaver::find_sample(TString sample){
   if(plot_lib.find(sample) == plot_lib.end()) return 0;
@@ -785,67 +1776,182 @@ bool histSaver::find_sample(TString sample){
 
 bool histSaver::add_variation(TString sample,TString reg,TString variation){
   if(!find_sample(sample)) return 0;
-  if(outputfile.find(variation) == outputfile.end()) outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root", "update");
+  if(outputfile.find(variation) == outputfile.end()) openoutput(variation);
   else outputfile[variation]->cd();
-  for (int i = 0; i < v.size(); ++i){
-    if(plot_lib[sample][reg].begin() == plot_lib[sample][reg].end()) {
-      printf("histSaver::add_variation() ERROR: No variation defined yet, cant add new variation\n");
-      exit(0);
-    }
-    TH1D *created = (TH1D*) plot_lib[sample][reg][createdNP].at(i);
-    if(!created){
-      printf("histSaver::add_variation() ERROR: hist doesn't exist: plot_lib[%s][%s][%s][%d]\n",sample.Data(), reg.Data(), plot_lib[sample][reg].begin()->first.Data(),i);
-      exit(0);
+  plot_lib[sample][reg][variation].resize(v.size(),0);
+  fillbooked.insert(&plot_lib[sample][reg][variation]);
+  return 1;
+}
+
+TFile* histSaver::openoutput(TString variation, TString option){
+  if(writer) writer->wait(); //a queued complete() job may still write or close this file
+  TString filename = outputfilename + "_" + variation + ".root";
+  freshoutput[variation] = option == "recreate" || gSystem->AccessPathName(filename);
+  outputfile[variation] = new TFile(filename, option);
+  if(compressionsettings >= 0) outputfile[variation]->SetCompressionSettings(compressionsettings);
+  return outputfile[variation];
+}
+
+void histSaver::set_compression(ROOT::RCompressionSetting::EAlgorithm::EValues algorithm, int level){
+  compressionsettings = ROOT::CompressionSettings(algorithm, level);
+  for(auto& iter: outputfile) iter.second->SetCompressionSettings(compressionsettings);
+}
+
+int histSaver::writehists(TFile *file, vector<TH1D*> &hists, Option_t *option){
+  //unallocated histograms are empty and not written
+  auto firsthist = find_if(hists.begin(), hists.end(), [](TH1D *hist){return hist != 0;});
+  if(firsthist == hists.end()) return 0;
+  double sum = (*firsthist)->Integral();
+  if(sum == 0) return 0;
+  if(sum != sum) {
+    printf("Warning: hist integral is nan, skip writing for %s\n", (*firsthist)->GetName());
+    return 0;
+  }
+  int nwritten = 0;
+  for (int i = 0; i < hists.size(); ++i){
+    if(!hists[i]) continue;
+    if(hists[i]->GetMaximum() == sum && hists[i]->GetEntries()>10) {
+      continue;
     }
-    created = (TH1D*) created->Clone(sample + "_" + variation + "_" + reg + "_" + v.at(i)->name + "_buffer");
-    created->Reset();
-    created->SetDirectory(0);
-    plot_lib[sample][reg][variation].push_back(created);
+    TString writename = hists[i]->GetName();
+    writename.Remove(writename.Sizeof()-8,7); //remove "_buffer"
+    if(debug) printf("write histogram: %s\n", writename.Data());
+    file->WriteTObject(hists[i], writename, option);
+    nwritten++;
   }
-  return 1;
+  return nwritten;
+}
+
+bool histSaver::iscompleted(TString sample, TString variation){
+  return find(completedvariations.begin(), completedvariations.end(), variation) != completedvariations.end() ||
+    find(completedsamples.begin(), completedsamples.end(), sample) != completedsamples.end();
+}
+
+void histSaver::checkcompleted(TString sample, TString variation){
+  if(iscompleted(sample, variation)) {
+    printf("histSaver::fill_hist() ERROR: sample %s variation %s filled after it was completed\n", sample.Data(), variation.Data());
+    exit(0);
+  }
+}
+
+void histSaver::complete_variation(TString variation){
+  complete("", variation);
 }
 
-void histSaver::write(){
-  for(auto& iter: outputfile){
+void histSaver::complete_sample(TString sample){
+  complete(sample, "");
+}
+
+void histSaver::complete(TString sample, TString variation){
+  auto matches = [&](TString samplename, TString variationname){
+    return (sample == "" || samplename == sample) && (variation == "" || variationname == variation);
+  };
+  load_lazy();
+  for (int islot = 0; islot < slots.size(); ++islot){
+    fillSlot &slot = slots[islot];
+    if(!matches(slot.sample, slot.variation)) continue;
+    sync_slot(islot);
+    //nothing is filled into the slot any more
+    slot.completed = 1;
+    slot.ivars.clear();
+    for(auto &block : slot.sumw) block = 0;
+    for(auto &block : slot.sumw2) block = 0;
+  }
+  //the histograms move to the writer, plot_lib keeps unallocated entries. Entries detached by an earlier
+  //complete() are all null and their variation file may be closed already.
+  map<TString, vector<vector<TH1D*>>> detached;
+  for(auto& samp : plot_lib){
+    for(auto& region : samp.second)
+      for(auto& vari : region.second){
+        if(!matches(samp.first, vari.first)) continue;
+        if(find(completedvariations.begin(), completedvariations.end(), vari.first) != completedvariations.end()) continue;
+        if(all_of(vari.second.begin(), vari.second.end(), [](TH1D *hist){ return !hist; })) continue;
+        auto &hists = detached[vari.first];
+        hists.push_back(vari.second);
+        vari.second.assign(vari.second.size(), 0);
+      }
+  }
+  if(sample != "") completedsamples.push_back(sample);
+  if(variation != "") completedvariations.push_back(variation);
+  if(!writer) {
+    ROOT::EnableThreadSafety();
+    writer = new BackgroundWriter();
+  }
+  for(auto &vari : detached){
+    if(outputfile.find(vari.first) == outputfile.end()) openoutput(vari.first);
+    TFile *file = outputfile[vari.first];
+    Option_t *option = freshoutput[vari.first] ? "" : "WriteDelete";
+    bool closefile = variation != "";
+    if(closefile) outputfile.erase(vari.first);
+    vector<vector<TH1D*>> hists = vari.second;
+    writer->push([this, file, option, closefile, hists]() mutable {
+      int nwritten = 0;
+      for(auto &variationhists : hists){
+        nwritten += writehists(file, variationhists, option);
+        for(auto &hist : variationhists) deletepointer(hist);
+      }
+      if(closefile) {
+        file->Close();
+        printf("histSaver::complete() : %d histograms written to %s, closed\n", nwritten, file->GetName());
+        delete file;
+      }else printf("histSaver::complete() : %d histograms written to %s\n", nwritten, file->GetName());
+    });
+  }
+}
+
+void histSaver::write(int nthreads){
+  if(writer) writer->wait();
+  load_lazy();
+  sync_slots();
+  auto start = chrono::steady_clock::now();
+  vector<pair<TString,TFile*>> files(outputfile.begin(), outputfile.end());
+  //one task per variation file, the histograms are only read here
+  auto writefile = [&](TString variationname, TFile *file){
+    Option_t *option = freshoutput[variationname] ? "" : "WriteDelete"; //nothing to replace in a new file
     for(auto& sample : plot_lib){
       for(auto& region: sample.second) {
-        auto variation = region.second.find(iter.first);
+        auto variation = region.second.find(variationname);
         if(variation == region.second.end()) continue;
-        double sum = variation->second[0]->Integral();
-        if(sum == 0) continue;
-        if(sum != sum) {
-          printf("Warning: hist integral is nan, skip writing for %s\n", variation->second[0]->GetName());
-          continue;
-        }
-        outputfile[variation->first]->cd();
-        for (int i = 0; i < v.size(); ++i){
-          if(variation->second[i]->GetMaximum() == sum && variation->second[i]->GetEntries()>10) {
-            continue;
-          }
-          //if(grabhist(iter.first,region,i)->Integral() == 0) {
-          //  printf("Warning: histogram is empty: %s, %s, %d\n", iter.first.Data(),region.Data(),i);
-          //}
-          TString writename = variation->second[i]->GetName();
-          writename.Remove(writename.Sizeof()-8,7); //remove "_buffer"
-          if(debug) printf("write histogram: %s\n", writename.Data());
-          variation->second[i]->Write(writename,TObject::kWriteDelete);
-        }
-        
+        writehists(file, variation->second, option);
       }
     }
-    iter.second->Close();
-    printf("histSaver::write() Written to file %s\n", iter.second->GetName());
-  }
+    file->Close();
+    printf("histSaver::write() Written to file %s\n", file->GetName());
+  };
+  if(nthreads <= 0) nthreads = thread::hardware_concurrency();
+  if(nthreads > files.size()) nthreads = files.size();
+  if(nthreads <= 1) {
+    for(auto& iter: files) writefile(iter.first, iter.second);
+  }else{
+    ROOT::EnableThreadSafety();
+    atomic<int> nextfile(0);
+    vector<thread> workers;
+    for (int ithread = 0; ithread < nthreads; ++ithread)
+      workers.emplace_back([&](){
+        for(int ifile = nextfile++; ifile < files.size(); ifile = nextfile++) writefile(files[ifile].first, files[ifile].second);
+      });
+    for(auto &worker : workers) worker.join();
+  }
+  printf("histSaver::write() : %lu files written with %d threads in %4.2f s\n", files.size(), max(nthreads,1), chrono::duration<double>(chrono::steady_clock::now() - start).count());
 }
 
 void histSaver::write_trexinput(TString NPname, TString writename, TString writeoption){
-  if (writename == "")
-  {
-    writename = NPname;
-  }
-  gSystem->mkdir(trexdir);
+  write_trexinput(vector<TString>{NPname}, vector<TString>{writename}, writeoption);
+}
+
+void histSaver::write_trexinput(vector<TString> NPnames, vector<TString> writenames, TString writeoption, bool consolidated){
+  auto start = chrono::steady_clock::now();
+  writenames.resize(NPnames.size());
+  for (int k = 0; k < NPnames.size(); ++k) if(writenames[k] == "") writenames[k] = NPnames[k];
+  sync_slots();
+  int nfile = 0, nhist = 0;
+  TFile *outputfile = 0;
+  if(consolidated) {
+    outputfile = new TFile(trexdir + ".root", writeoption);
+    nfile++;
+  }else gSystem->mkdir(trexdir);
   for (int i = 0; i < v.size(); ++i){
-    gSystem->mkdir(trexdir + "/" + v.at(i)->name);
+    if(!consolidated) gSystem->mkdir(trexdir + "/" + v.at(i)->name);
     for(auto const& region: regions) {
       bool muted = 0;
       for (auto const& mutedregion: mutedregions)
@@ -853,35 +1959,57 @@ void histSaver::write_trexinput(TString NPname, TString writename, TString write
         if(region.Contains(mutedregion))
           muted = 1;
       }
-      if(muted) continue;
+      if(muted || !isactive(region, i)) continue;
 
-      gSystem->mkdir(trexdir + "/" + v.at(i)->name + "/" + region);
+      if(!consolidated) gSystem->mkdir(trexdir + "/" + v.at(i)->name + "/" + region);
       for(auto& iter : plot_lib){
-        if(NPname != "NOMINAL" && iter.first.Contains("data")) continue;
-        TString filename = trexdir + "/" + v.at(i)->name + "/" + region + "/" + iter.first + ".root";
-        TFile outputfile(filename, writeoption);
-        if(debug) printf("Writing to file: %s, histoname: %s\n", filename.Data(), writename.Data());
-        TH1D *target = grabhist(iter.first,region,NPname,i);
-        if(target) {
-          target->Write(writename,TObject::kWriteDelete);
-          if(!target->Integral()) printf("Warinig: plot_lib[%s][%s][%d] is empty\n", iter.first.Data(),region.Data(),i);
+        bool isdata = iter.first.Contains("data");
+        if(isdata && find(NPnames.begin(), NPnames.end(), "NOMINAL") == NPnames.end()) continue;
+        TString path = v.at(i)->name + "/" + region + "/" + iter.first;
+        if(consolidated){
+          if(!outputfile->GetDirectory(path)) outputfile->mkdir(path);
+          outputfile->GetDirectory(path)->cd();
+        }else{
+          outputfile = new TFile(trexdir + "/" + path + ".root", writeoption);
+          nfile++;
+        }
+        for (int k = 0; k < NPnames.size(); ++k){
+          if(NPnames[k] != "NOMINAL" && isdata) continue;
+          if(debug) printf("Writing to file: %s, histoname: %s\n", outputfile->GetName(), (path + "/" + writenames[k]).Data());
+          TH1D *target = grabhist(iter.first,region,NPnames[k],i);
+          if(target) {
+            target->Write(writenames[k],TObject::kWriteDelete);
+            nhist++;
+            if(!target->Integral()) printf("Warinig: plot_lib[%s][%s][%s][%d] is empty\n", iter.first.Data(),region.Data(),NPnames[k].Data(),i);
+          }
+          else if(debug) printf("Warning: histogram plot_lib[%s][%s][%s][%d] not found\n", iter.first.Data(),region.Data(),NPnames[k].Data(),i);
+        }
+        if(!consolidated){
+          outputfile->Close();
+          deletepointer(outputfile);
         }
-        else if(debug) printf("Warning: histogram plot_lib[%s][%s][%d] not found\n", iter.first.Data(),region.Data(),i);
-        outputfile.Close();
       }
     }
   }
+  if(consolidated){
+    outputfile->Close();
+    deletepointer(outputfile);
+  }
+  printf("histSaver::write_trexinput() : %d histograms of %lu variations written to %d files in %4.2f s\n", nhist, NPnames.size(), nfile, chrono::duration<double>(chrono::steady_clock::now() - start).count());
 }
+
 void histSaver::clearhist(){
   if(debug) printf("histSaver::clearhist()\n");
+  sync_slots();
+  lazy_lib.clear(); //registered reads are dropped as well
   for(auto& sample : plot_lib){
     for(auto& region: sample.second) {
       for(auto& variation : region.second){
         for (int i = 0; i < v.size(); ++i){
-          if(variation.second[i]){
-            variation.second[i]->Reset();
-          }else{
+          if(variation.second.size() <= i) {
             printf("histSaver::Reset() Error: histogram not found: sample: %s, variable: %s, region: %s\n",sample.first.Data(), v.at(i)->name.Data(),region.first.Data());
+          }else if(variation.second[i]){
+            variation.second[i]->Reset();
           }
         }
       }
@@ -899,7 +2027,7 @@ observable histSaver::templatesample(TString fromregion, TString variation,strin
 
 observable histSaver::templatesample(TString fromregion, TString variation,string formula,TString toregion,TString newsamplename,TString newsampletitle,enum EColor color, bool scaletogap, observable SF){
 
-  if(outputfile.find(variation) == outputfile.end()) outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root", "update");
+  if(outputfile.find(variation) == outputfile.end()) openoutput(variation);
   else outputfile[variation]->cd();
   istringstream iss(formula);
   vector<string> tokens{istream_iterator<string>{iss},
@@ -908,9 +2036,10 @@ observable histSaver::templatesample(TString fromregion, TString variation,strin
   vector<TH1D*> newvec;
   observable scaleto(0,0);
   bool sampexist = find_sample(newsamplename);
+  int iyield = yieldvar(toregion);
   for (int ivar = 0; ivar < v.size(); ++ivar)
   {
-    TH1D *target = grabhist(tokens[1],fromregion, tokens[1] == "data" ? "NOMINAL" : variation,ivar);
+    TH1D *target = isactive(toregion, ivar) ? grabhist(tokens[1],fromregion, tokens[1] == "data" ? "NOMINAL" : variation,ivar) : 0;
     if(target){
       newvec.push_back((TH1D*)target->Clone(sampexist?"tmp":""+newsamplename+"_"+toregion+v[ivar]->name));
       newvec[ivar]->Reset();
@@ -931,10 +2060,10 @@ observable histSaver::templatesample(TString fromregion, TString variation,strin
       printf("Error: Wrong formula format: %s\nShould be like: 1 data -1 real -1 zll ...", formula.c_str());
       exit(1);
     }
-    if(grabhist(tokens[icompon+1],toregion, tokens[icompon+1] == "data" ? "NOMINAL" : variation,0)){
+    if(grabhist(tokens[icompon+1],toregion, tokens[icompon+1] == "data" ? "NOMINAL" : variation,iyield)){
       if(scaletogap) {
         double error = 0;
-        observable tmp(grabhist(tokens[icompon+1],toregion, tokens[icompon+1] == "data" ? "NOMINAL" : variation,0)->Integral(),gethisterror(grabhist(tokens[icompon+1],toregion, tokens[icompon+1] == "data" ? "NOMINAL" : variation,0)));
+        observable tmp(grabhist(tokens[icompon+1],toregion, tokens[icompon+1] == "data" ? "NOMINAL" : variation,iyield)->Integral(),gethisterror(grabhist(tokens[icompon+1],toregion, tokens[icompon+1] == "data" ? "NOMINAL" : variation,iyield)));
         scaleto += tmp*numb;
       }
       for (int ivar = 0; ivar < v.size(); ++ivar)
@@ -946,7 +2075,12 @@ observable histSaver::templatesample(TString fromregion, TString variation,strin
   }
   observable scalefactor;
   if(scaletogap) {
-    observable scalefrom(newvec[0]->Integral(),gethisterror(newvec[0]));
+    int ifrom = yieldvar(fromregion);
+    if(ifrom < 0 || !newvec[ifrom]) {
+      printf("histSaver::templatesample() ERROR: no %s histogram of %s in region %s to scale from\n", ifrom < 0 ? "active" : v[ifrom]->name.Data(), tokens[1].c_str(), fromregion.Data());
+      exit(0);
+    }
+    observable scalefrom(newvec[ifrom]->Integral(),gethisterror(newvec[ifrom]));
     scalefactor = scaleto/scalefrom;
     printf("scale from %s: %4.2f +/- %4.2f\nto %s: %4.2f +/- %4.2f\nratio: %4.2f +/- %4.2f\n\n",
       fromregion.Data(), scalefrom.nominal, scalefrom.error,
@@ -1005,6 +2139,51 @@ void histSaver::unmuteregion(TString region){
   else printf("histSaver::unmuteregion WARNING: region %s is not in the mute list\n",region.Data());
 }
 
+void histSaver::set_region_variables(TString regionpattern, vector<TString> varnames){
+  regionVariables rule;
+  rule.region = regionpattern;
+  rule.exact = 0;
+  for(auto varname : varnames) rule.ivars.push_back(findvar(varname));
+  regionvariables.push_back(rule);
+  activevarcache.clear();
+  if(slots.size()) printf("histSaver::set_region_variables() WARNING: %lu slots are already booked with the previous variable selection\n", slots.size());
+}
+
+void histSaver::set_region_variables(vector<TString> regionnames, vector<TString> varnames){
+  for(auto region : regionnames){
+    set_region_variables(region, varnames);
+    regionvariables.back().exact = 1;
+  }
+}
+
+const vector<int>& histSaver::activevars(TString region){
+  auto cached = activevarcache.find(region);
+  if(cached != activevarcache.end()) return cached->second;
+  vector<char> active(v.size(), 0);
+  bool matched = 0;
+  for(auto const& rule : regionvariables){
+    if(rule.exact ? region != rule.region : !region.Contains(rule.region)) continue;
+    matched = 1;
+    for(auto ivar : rule.ivars) active[ivar] = 1;
+  }
+  auto &ivars = activevarcache[region];
+  for (int i = 0; i < v.size(); ++i) if(!matched || active[i]) ivars.push_back(i);
+  return ivars;
+}
+
+int histSaver::yieldvar(TString region){
+  int iyield = yieldvariable == "" ? -1 : varid(yieldvariable);
+  if(iyield >= 0 && isactive(region, iyield)) return iyield;
+  const vector<int> &ivars = activevars(region);
+  return ivars.size() ? ivars[0] : -1;
+}
+
+bool histSaver::isactive(TString region, int ivar){
+  if(!regionvariables.size()) return 1;
+  const vector<int> &ivars = activevars(region);
+  return find(ivars.begin(), ivars.end(), ivar) != ivars.end();
+}
+
 void histSaver::SetLumiAnaWorkflow(TString _lumi, TString _analysis, TString _workflow){
   lumi = _lumi;
   analysis = _analysis;
@@ -1041,6 +2220,7 @@ void histSaver::plot_stack(TString NPname, TString outdir, TString outputchartdi
 
 
     for (int i = 0; i < v.size(); ++i){
+      if(!isactive(region, i)) continue;
       TPad *padlow = new TPad("lowpad","lowpad",0,0,1,0.3);
       TPad *padhi  = new TPad("hipad","hipad",0,0.3,1,1);
       TH1D hmc("hmc","hmc",v[i]->nbins/v[i]->rebin,v[i]->xlow,v[i]->xhigh);
@@ -1347,7 +2527,7 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
   final_region=final_region+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_1m1lregion=_1m1lregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_1l1mregion=_1l1mregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_1l1nregion=_1l1nregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_1n1lregion=_1n1lregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_2nregion=_2nregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");
   std::vector<TString> tokens=tmp_regions;
   if(outputfile.find(variation) == outputfile.end()) {
-    outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root", "recreate");
+    openoutput(variation, "recreate");
   }else{
     outputfile[variation]->cd();
   } 
@@ -1356,10 +2536,13 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
   vector<TH1D*> newvec;
   for (int ivar = 0; ivar < v.size(); ++ivar)
   { 
-    if(!grabhist(tokens[0],_1m1lregion, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar)){
-      std::cout<<"ivar: "<<ivar<<", data hist dont exist!"<<std::endl;
+    TH1D *target = isactive(final_region, ivar) ? grabhist(tokens[0],_1m1lregion, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar) : 0;
+    if(!target){
+      if(isactive(_1m1lregion, ivar)) std::cout<<"ivar: "<<ivar<<", data hist dont exist!"<<std::endl;
+      newvec.push_back(0);
+      continue;
     }
-    newvec.push_back((TH1D*)grabhist(tokens[0],_1m1lregion, tokens[0] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar)->Clone(newsamplename+"_"+final_region+v[ivar]->name));
+    newvec.push_back((TH1D*)target->Clone(newsamplename+"_"+final_region+v[ivar]->name));
     newvec[ivar]->Reset();
     newvec[ivar]->SetNameTitle(newsamplename,newsampletitle);
     newvec[ivar]->SetFillColor(color);
@@ -1375,15 +2558,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
     if(icompon==0)sign_=1;
     else sign_=-1;
 
-    if(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)){ 
-      if(fabs(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1m1lregion<<", integral: "<<(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1m1lregion))){ 
+      if(fabs(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1m1lregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1m1lregion<<", integral: "<<(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,yieldvar(_1m1lregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_1m1lregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_1m1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1395,15 +2579,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
     if(icompon==0)sign_=1;
     else sign_=-1;
 
-    if(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)){ 
-      if(fabs(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1l1mregion<<", integral: "<<(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1l1mregion))){ 
+      if(fabs(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1l1mregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1l1mregion<<", integral: "<<(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1l1mregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_1l1mregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_1l1mregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1416,15 +2601,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
     if(icompon==0)sign_=-1;
     else sign_=1;
 
-    if(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)){ // 如果直方图存在
-      if(fabs(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1l1nregion<<", integral: "<<(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1l1nregion))){ // 如果直方图存在
+      if(fabs(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1l1nregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1l1nregion<<", integral: "<<(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1l1nregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<", in region:"<<_1l1nregion<<", have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_1l1nregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1436,15 +2622,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
     if(icompon==0)sign_=-1;
     else sign_=1;
 
-    if(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,0)){ // 如果直方图存在
-      if(fabs(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1n1lregion<<", integral: "<<(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,yieldvar(_1n1lregion))){ // 如果直方图存在
+      if(fabs(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1n1lregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1n1lregion<<", integral: "<<(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data"&& !variation.Contains("FFNP_") ? "NOMINAL" : variation,yieldvar(_1n1lregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_1n1lregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_1n1lregion, tokens[icompon] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1456,16 +2643,17 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lregion,TStri
     if(icompon==0)sign_=-1;
     else sign_=1;
 
-    if(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)){ // 如果直方图存在
-      if(fabs(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_2nregion<<", integral: "<<(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_2nregion))){ // 如果直方图存在
+      if(fabs(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_2nregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_2nregion<<", integral: "<<(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_2nregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_2nregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
         if(_2nregion=="reg2ltau1b3jos"&&tokens[icompon]=="other") std::cout<<"ivar: "<<ivar<<std::endl;
-        newvec[ivar]->Add(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1483,7 +2671,7 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lnmregion,TSt
   final_region=final_region+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_1m1lnmregion=_1m1lnmregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_1lnm1mregion=_1lnm1mregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");_2nregion=_2nregion+"_vetobtagwp70"+(!SBplot?"_highmet":"_highmet_SB");
   std::vector<TString> tokens=tmp_regions;
   if(outputfile.find(variation) == outputfile.end()) {
-    outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root", "recreate");
+    openoutput(variation, "recreate");
   }else{
     outputfile[variation]->cd();
   } 
@@ -1492,10 +2680,13 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lnmregion,TSt
   vector<TH1D*> newvec;
   for (int ivar = 0; ivar < v.size(); ++ivar)
   { 
-    if(!grabhist(tokens[0],_1m1lnmregion, tokens[0] == "data" ? "NOMINAL" : variation,ivar)){
-      std::cout<<"ivar: "<<ivar<<", data hist dont exist!"<<std::endl;
+    TH1D *target = isactive(final_region, ivar) ? grabhist(tokens[0],_1m1lnmregion, tokens[0] == "data" ? "NOMINAL" : variation,ivar) : 0;
+    if(!target){
+      if(isactive(_1m1lnmregion, ivar)) std::cout<<"ivar: "<<ivar<<", data hist dont exist!"<<std::endl;
+      newvec.push_back(0);
+      continue;
     }
-    newvec.push_back((TH1D*)grabhist(tokens[0],_1m1lnmregion, tokens[0] == "data" ? "NOMINAL" : variation,ivar)->Clone(newsamplename+"_"+final_region+v[ivar]->name));
+    newvec.push_back((TH1D*)target->Clone(newsamplename+"_"+final_region+v[ivar]->name));
     newvec[ivar]->Reset();
     newvec[ivar]->SetNameTitle(newsamplename,newsampletitle);
     newvec[ivar]->SetFillColor(color);
@@ -1511,15 +2702,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lnmregion,TSt
     if(icompon==0)sign_=1;
     else sign_=-1;
 
-    if(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)){ 
-      if(fabs(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1m1lnmregion<<", integral: "<<(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_1m1lnmregion))){ 
+      if(fabs(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_1m1lnmregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1m1lnmregion<<", integral: "<<(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_1m1lnmregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_1m1lnmregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_1m1lnmregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1531,15 +2723,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lnmregion,TSt
     if(icompon==0)sign_=1;
     else sign_=-1;
 
-    if(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)){ 
-      if(fabs(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1lnm1mregion<<", integral: "<<(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_1lnm1mregion))){ 
+      if(fabs(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_1lnm1mregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_1lnm1mregion<<", integral: "<<(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_1lnm1mregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_1lnm1mregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_1lnm1mregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1553,16 +2746,17 @@ void histSaver::FakeFactorMethod(TString final_region, TString _1m1lnmregion,TSt
     if(icompon==0)sign_=-1;
     else sign_=1;
 
-    if(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)){ // 如果直方图存在
-      if(fabs(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_2nregion<<", integral: "<<(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_2nregion))){ // 如果直方图存在
+      if(fabs(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_2nregion))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_2nregion<<", integral: "<<(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,yieldvar(_2nregion))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_2nregion<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
         if(_2nregion=="reg2ltau1b3jos"&&tokens[icompon]=="other") std::cout<<"ivar: "<<ivar<<std::endl;
-        newvec[ivar]->Add(grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_2nregion, tokens[icompon] == "data" ? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -1582,7 +2776,7 @@ void histSaver::FakeFactorMethod(TString final_region, TString _reg1mtau1ltau1b2
   std::vector<TString> tokens=tmp_regions;
   std::cout<<"name by mxia:"<<outputfilename + "_" + variation + ".root"<<std::endl;
   if(outputfile.find(variation) == outputfile.end()) {
-    outputfile[variation] = new TFile(outputfilename + "_" + variation + ".root", "recreate");
+    openoutput(variation, "recreate");
   }else{
     outputfile[variation]->cd();
   } 
@@ -1591,10 +2785,13 @@ void histSaver::FakeFactorMethod(TString final_region, TString _reg1mtau1ltau1b2
   vector<TH1D*> newvec;
   for (int ivar = 0; ivar < v.size(); ++ivar)
   { 
-    if(!grabhist(tokens[0],_reg1mtau1ltau1b2jos, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar)){
-      std::cout<<"ivar: "<<ivar<<", data hist dont exist!"<<std::endl;
+    TH1D *target = isactive(final_region, ivar) ? grabhist(tokens[0],_reg1mtau1ltau1b2jos, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar) : 0;
+    if(!target){
+      if(isactive(_reg1mtau1ltau1b2jos, ivar)) std::cout<<"ivar: "<<ivar<<", data hist dont exist!"<<std::endl;
+      newvec.push_back(0);
+      continue;
     }
-    newvec.push_back((TH1D*)grabhist(tokens[0],_reg1mtau1ltau1b2jos,  tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar)->Clone(newsamplename+"_"+final_region+v[ivar]->name));
+    newvec.push_back((TH1D*)target->Clone(newsamplename+"_"+final_region+v[ivar]->name));
     newvec[ivar]->Reset();
     newvec[ivar]->SetNameTitle(newsamplename,newsampletitle);
     newvec[ivar]->SetFillColor(color);
@@ -1610,15 +2807,16 @@ void histSaver::FakeFactorMethod(TString final_region, TString _reg1mtau1ltau1b2
     if(icompon==0)sign_=1;
     else sign_=-1;
 
-    if(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,0)){ 
-      if(fabs(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos,tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,0)->Integral())<10E-06){
-        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_reg1mtau1ltau1b2jos<<", integral: "<<(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos,tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,0)->Integral())<<std::endl;
+    if(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,yieldvar(_reg1mtau1ltau1b2jos))){ 
+      if(fabs(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos,tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,yieldvar(_reg1mtau1ltau1b2jos))->Integral())<10E-06){
+        std::cout<<"sample name:"<<tokens[icompon]<<" in region:"<<_reg1mtau1ltau1b2jos<<", integral: "<<(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos,tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,yieldvar(_reg1mtau1ltau1b2jos))->Integral())<<std::endl;
         continue;
       }
       std::cout<<"sample name:"<<tokens[icompon]<<", sign:"<<sign_<<" in region:"<<_reg1mtau1ltau1b2jos<<" have contribution to the fake calculations!"<<std::endl;
       for (int ivar = 0; ivar < v.size(); ++ivar)
       {
-        newvec[ivar]->Add(grabhist(tokens[icompon],_reg1mtau1ltau1b2jos, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar),sign_);
+        TH1D *source = grabhist(tokens[icompon],_reg1mtau1ltau1b2jos, tokens[0] == "data" && !variation.Contains("FFNP_")? "NOMINAL" : variation,ivar);
+        if(newvec[ivar] && source) newvec[ivar]->Add(source,sign_);
       }
     }
   }
@@ -0,0 +1,269 @@
+#include "histSaver.h"
+#include "FillShard.h"
+#include "fcnc_include.h"
+#include "TRandom.h"
+#include <chrono>
+#include <thread>
+#include <vector>
+using namespace std;
+
+//fill rate of histSaver in a typical setup: nvar variables, nfillregion regions per event, nvariation variations
+const int nvar = 40;
+const int nregion = 30;
+const int nfillregion = 10;
+const int nvariation = 4;
+const long blocksize = 1024;
+
+double elapsed(chrono::steady_clock::time_point start){
+	return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+histSaver* setup(vector<float> &values, float &weight, int nbins = 50){
+	histSaver *saver = new histSaver("benchmark");
+	saver->debug = 0;
+	saver->set_weight(&weight);
+	for (int i = 0; i < nvar; ++i)
+		saver->add(new variable(CharAppend("var",i), CharAppend("var",i), nbins, 0, 100), &values[i]);
+	for (int i = 0; i < nregion; ++i)
+		saver->add_region(CharAppend("region",i));
+	saver->add_sample("bkg","background",kBlue);
+	return saver;
+}
+
+vector<FillHandle> bookall(histSaver *saver, vector<TString> &variations){
+	vector<FillHandle> handles;
+	for (int ireg = 0; ireg < nfillregion; ++ireg)
+		for(auto variation : variations)
+			handles.push_back(saver->book("bkg", saver->regions[ireg*nregion/nfillregion], variation));
+	return handles;
+}
+
+//bytes of the bins of nslot booked slots
+double slotbytes(int nslot, int nbins){
+	return nslot*nvar*2.*(nbins+2)*sizeof(double);
+}
+
+//GetEntry() equivalent
+void getentry(long ievt, vector<vector<float>> &columns, vector<double> &weights, vector<float> &values, float &weight){
+	for (int i = 0; i < nvar; ++i) values[i] = columns[i][ievt];
+	weight = weights[ievt];
+}
+
+int main(int argc, char const *argv[])
+{
+	long nevent = argc > 1 ? atol(argv[1]) : 20000;
+	vector<float> values(nvar);
+	float weight;
+	vector<TString> variations = {"NOMINAL"};
+	for (int i = 1; i < nvariation; ++i) variations.push_back(CharAppend("NP",i));
+
+	vector<vector<float>> columns(nvar, vector<float>(nevent));
+	vector<double> weights(nevent);
+	for (long ievt = 0; ievt < nevent; ++ievt){
+		for (int i = 0; i < nvar; ++i) columns[i][ievt] = gRandom->Uniform(120);
+		weights[ievt] = gRandom->Uniform(2);
+	}
+
+	histSaver *saver = setup(values, weight);
+	auto start = chrono::steady_clock::now();
+	for (long ievt = 0; ievt < nevent; ++ievt)
+	{
+		getentry(ievt, columns, weights, values, weight);
+		for (int ireg = 0; ireg < nfillregion; ++ireg)
+			for(auto variation : variations)
+				saver->fill_hist("bkg", saver->regions[ireg*nregion/nfillregion], variation);
+	}
+	double tstring = elapsed(start);
+	printf("fill_hist(TString,TString,TString): %ld events in %4.2f s, %.0f events/s\n", nevent, tstring, nevent/tstring);
+	delete saver;
+
+	for (int usearena = 0; usearena < 2; ++usearena)
+	{
+		saver = setup(values, weight);
+		saver->usearena = usearena;
+		vector<FillHandle> handles = bookall(saver, variations);
+		start = chrono::steady_clock::now();
+		for (long ievt = 0; ievt < nevent; ++ievt)
+		{
+			getentry(ievt, columns, weights, values, weight);
+			for(auto handle : handles)
+				saver->fill_hist(handle);
+		}
+		double thandle = elapsed(start);
+		printf("fill_hist(FillHandle)%s: %ld events in %4.2f s, %.0f events/s, speed up %4.2f\n", usearena ? " with arena" : "", nevent, thandle, nevent/thandle, tstring/thandle);
+		if(usearena) printf("arena: %ld allocations, %ld doubles\n", saver->arena->nalloc, saver->arena->total);
+		delete saver;
+	}
+
+	//the variations as weight-only variations, filled in one pass per region
+	for (int usearena = 0; usearena < 2; ++usearena)
+	{
+		saver = setup(values, weight);
+		saver->usearena = usearena;
+		vector<FanoutHandle> handles;
+		vector<TString> weightvariations(variations.begin()+1, variations.end());
+		for (int ireg = 0; ireg < nfillregion; ++ireg)
+			handles.push_back(saver->book_fanout("bkg", saver->regions[ireg*nregion/nfillregion], "NOMINAL", weightvariations));
+		vector<double> fanweights(nvariation);
+		start = chrono::steady_clock::now();
+		for (long ievt = 0; ievt < nevent; ++ievt)
+		{
+			getentry(ievt, columns, weights, values, weight);
+			for (int k = 0; k < nvariation; ++k) fanweights[k] = weight*(1+0.01*k);
+			for(auto &handle : handles)
+				saver->fill_hist(handle, fanweights.data());
+		}
+		double tfanout = elapsed(start);
+		printf("fill_hist(FanoutHandle)%s: %ld events in %4.2f s, %.0f events/s, speed up %4.2f\n", usearena ? " with arena" : "", nevent, tfanout, nevent/tfanout, tstring/tfanout);
+		delete saver;
+	}
+
+	//all regions of an event in one call per variation
+	for (int usearena = 0; usearena < 2; ++usearena)
+	{
+		saver = setup(values, weight);
+		saver->usearena = usearena;
+		vector<RegionHandle> handles;
+		for(auto variation : variations) handles.push_back(saver->book_regions("bkg", variation));
+		vector<int> regionids;
+		for (int ireg = 0; ireg < nfillregion; ++ireg) regionids.push_back(ireg*nregion/nfillregion);
+		start = chrono::steady_clock::now();
+		for (long ievt = 0; ievt < nevent; ++ievt)
+		{
+			getentry(ievt, columns, weights, values, weight);
+			for(auto &handle : handles)
+				saver->fill_hist(handle, regionids);
+		}
+		double tregion = elapsed(start);
+		printf("fill_hist(RegionHandle)%s: %ld events in %4.2f s, %.0f events/s, speed up %4.2f\n", usearena ? " with arena" : "", nevent, tregion, nevent/tregion, tstring/tregion);
+		delete saver;
+	}
+
+	//columnar input, filled in blocks as read from bulk branches
+	for (int usearena = 0; usearena < 2; ++usearena)
+	{
+		saver = setup(values, weight);
+		saver->usearena = usearena;
+		vector<FillHandle> handles = bookall(saver, variations);
+		start = chrono::steady_clock::now();
+		for (long ievt = 0; ievt < nevent; ievt += blocksize)
+		{
+			long nblock = min(blocksize, nevent - ievt);
+			vector<const float*> block;
+			for (int i = 0; i < nvar; ++i) block.push_back(columns[i].data() + ievt);
+			for(auto handle : handles)
+				saver->fill_batch(handle, block, weights.data() + ievt, nblock);
+		}
+		double tbatch = elapsed(start);
+		printf("fill_batch(FillHandle)%s: %ld events in %4.2f s, %.0f events/s, speed up %4.2f\n", usearena ? " with arena" : "", nevent, tbatch, nevent/tbatch, tstring/tbatch);
+		delete saver;
+	}
+
+	//sparse occupancy: region specific weight systematics, variation k is only non-zero in one region
+	{
+		const int nsparsevariation = 100;
+		saver = setup(values, weight);
+		vector<TString> sparsevariations;
+		for (int k = 0; k < nsparsevariation; ++k) sparsevariations.push_back(CharAppend("SYS",k));
+		vector<FanoutHandle> handles;
+		for (int ireg = 0; ireg < nfillregion; ++ireg)
+			handles.push_back(saver->book_fanout("bkg", saver->regions[ireg*nregion/nfillregion], "NOMINAL", sparsevariations));
+		vector<double> fanweights(nsparsevariation+1);
+		for (long ievt = 0; ievt < nevent; ++ievt)
+		{
+			getentry(ievt, columns, weights, values, weight);
+			for (int ireg = 0; ireg < nfillregion; ++ireg){
+				fanweights[0] = weight;
+				for (int k = 0; k < nsparsevariation; ++k) fanweights[k+1] = k%nfillregion == ireg ? weight*1.01 : 0;
+				saver->fill_hist(handles[ireg], fanweights.data());
+			}
+		}
+		long nbooked = 0, nallocated = 0;
+		for(auto &region : saver->plot_lib["bkg"])
+			for(auto &variation : region.second)
+				for(auto hist : variation.second){
+					nbooked++;
+					if(hist) nallocated++;
+				}
+		printf("lazy booking: %ld of %ld booked histograms allocated\n", nallocated, nbooked);
+		delete saver;
+	}
+
+	//threads: private shards merged afterwards vs one set of bins with atomic adds, fewer bins means more contention
+	{
+		int nthreads = thread::hardware_concurrency();
+		for(int nbins : {2, 50, 2000})
+		{
+			double tmode[2];
+			for (int atomicfill = 0; atomicfill < 2; ++atomicfill)
+			{
+				saver = setup(values, weight, nbins);
+				saver->usearena = 1;
+				vector<FillHandle> handles = bookall(saver, variations);
+				auto fillrange = [&](FillShard *shard, int ithread, Long64_t first, Long64_t last){
+					vector<float> row(nvar);
+					for (Long64_t ievt = first; ievt < last; ++ievt){
+						for (int i = 0; i < nvar; ++i) row[i] = columns[i][ievt];
+						for(auto handle : handles) shard->fill(handle, row.data(), weights[ievt]);
+					}
+				};
+				start = chrono::steady_clock::now();
+				if(atomicfill) saver->fill_atomic(nevent, nthreads, fillrange);
+				else saver->fill_parallel(nevent, nthreads, fillrange);
+				tmode[atomicfill] = elapsed(start);
+				delete saver;
+			}
+			//a shard holds the bins of every filled slot, at most nthreads of them at a time
+			double shardmb = slotbytes(nfillregion*nvariation, nbins)*nthreads/1048576.;
+			printf("%d threads, %d bins: fill_parallel (shards, up to %.1f MB extra) %4.2f s, fill_atomic %4.2f s, atomic speed up %4.2f\n", nthreads, nbins, shardmb, tmode[0], tmode[1], tmode[0]/tmode[1]);
+		}
+	}
+
+	//post-processing lookups: grabhist by names and by interned ids
+	{
+		saver = setup(values, weight);
+		saver->usearena = 1;
+		vector<FillHandle> handles = bookall(saver, variations);
+		getentry(0, columns, weights, values, weight);
+		for(auto handle : handles) saver->fill_hist(handle);
+		saver->sync_slots();
+		long nlookup = nevent*10;
+		long nfound = 0;
+		start = chrono::steady_clock::now();
+		for (long ilookup = 0; ilookup < nlookup; ++ilookup)
+			nfound += saver->grabhist("bkg", saver->regions[(ilookup%nfillregion)*nregion/nfillregion], variations[ilookup%nvariation], int(ilookup%nvar)) != 0;
+		double tname = elapsed(start);
+		int isample = saver->sampleid("bkg");
+		vector<int> ivariations;
+		for(auto variation : variations) ivariations.push_back(saver->variationid(variation));
+		start = chrono::steady_clock::now();
+		for (long ilookup = 0; ilookup < nlookup; ++ilookup)
+			nfound += saver->grabhist(isample, (ilookup%nfillregion)*nregion/nfillregion, ivariations[ilookup%nvariation], int(ilookup%nvar)) != 0;
+		double tid = elapsed(start);
+		printf("grabhist: %.0f ns/lookup by name, %.0f ns/lookup by id (%ld found)\n", tname/nlookup*1e9, tid/nlookup*1e9, nfound);
+		delete saver;
+	}
+
+	//cost of reading one value per bound type
+	{
+		float fval = 42;
+		double dval = 42;
+		int ival = 42;
+		histSaver reader("getval");
+		reader.debug = 0;
+		reader.add(new variable("float","float",50,0,100), &fval);
+		reader.add(new variable("double","double",50,0,100), &dval);
+		reader.add(new variable("int","int",50,0,100), &ival);
+		reader.add(new variable("expression","expression",50,0,100), [&fval, &dval](){ return fval + dval; });
+		long nread = nevent*nvar;
+		for (int i = 0; i < reader.v.size(); ++i)
+		{
+			double sum = 0;
+			start = chrono::steady_clock::now();
+			for (long iread = 0; iread < nread; ++iread) sum += reader.getVal(i);
+			double tread = elapsed(start);
+			printf("getVal(%s): %.2f ns/call (checksum %.0f)\n", reader.v[i]->name.Data(), tread/nread*1e9, sum);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,59 @@
+#include "histDriver.h"
+#include "histSaver.h"
+#include <dlfcn.h>
+#include <fstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+//the fill library provides (compiled against PlotTool):
+//  extern "C" histSaver* histdriver_setup(const char *outputname); //add() variables, regions and samples
+//  extern "C" void histdriver_fill(histSaver *saver, const char *inputfile); //loop over the events of inputfile and fill
+typedef histSaver* (*setupfunction)(const char*);
+typedef void (*fillfunction)(histSaver*, const char*);
+
+void usage(){
+	printf("usage: histdriver_run <fill library> <output name> [-j nworkers] [-r nretry] [-w workdir] [-s] <input files | @filelist>\n");
+}
+
+int main(int argc, char const *argv[])
+{
+	if(argc < 4) {
+		usage();
+		return 1;
+	}
+	void *library = dlopen(argv[1], RTLD_NOW | RTLD_GLOBAL);
+	if(!library) {
+		printf("histdriver_run ERROR: %s\n", dlerror());
+		return 1;
+	}
+	setupfunction setup = (setupfunction)dlsym(library, "histdriver_setup");
+	fillfunction fill = (fillfunction)dlsym(library, "histdriver_fill");
+	if(!setup || !fill) {
+		printf("histdriver_run ERROR: %s does not provide histdriver_setup and histdriver_fill\n", argv[1]);
+		return 1;
+	}
+	histDriver driver([setup](TString outputname){ return setup(outputname.Data()); }, [fill](histSaver *saver, TString input){ fill(saver, input.Data()); });
+	vector<TString> inputs;
+	for (int i = 3; i < argc; ++i)
+	{
+		string arg = argv[i];
+		if(arg == "-j" && i+1 < argc) driver.nworkers = atoi(argv[++i]);
+		else if(arg == "-r" && i+1 < argc) driver.nretry = atoi(argv[++i]);
+		else if(arg == "-w" && i+1 < argc) driver.workdir = argv[++i];
+		else if(arg == "-s") driver.sharedmemory = 1;
+		else if(arg[0] == '@') {
+			ifstream filelist(arg.substr(1));
+			for(string line; getline(filelist, line);) if(line.size() && line[0] != '#') inputs.push_back(line.c_str());
+		}
+		else inputs.push_back(arg.c_str());
+	}
+	if(!inputs.size()) {
+		usage();
+		return 1;
+	}
+	histSaver *saver = driver.run(inputs, argv[2]);
+	saver->write();
+	delete saver;
+	return driver.failed.size() ? 1 : 0;
+}